@@ -0,0 +1,174 @@
+/*
+ * @brief     Incremental computation of B mode images
+ *
+ * @details   Every scanline goes through the stages raw -> rf (channel sum)
+ *            -> iq (demodulation and filter) -> envelope, and the image is
+ *            the log compression of the envelopes. The product of each stage
+ *            is stored in a content addressed cache (see cache.h) under the
+ *            hash of its input key and the stage parameters. The stages are
+ *            looked up from the last one backwards and only the missing ones
+ *            are computed. Changing dBRange or reject only redoes the log
+ *            compression; changing the filter reuses the cached RF.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "bmode.h"
+#include "cache.h"
+#include "processing.h"
+#include "parallel.h"
+
+/// Versions of the code of each stage, hashed in the keys of its products.
+/// Increment one when the stage changes its output, so the products of the
+/// old code are not served from the cache
+#define BMODE_RF_VERSION 1
+#define BMODE_IQ_VERSION 2
+#define BMODE_ENVELOPE_VERSION 2
+
+// Arguments of the per-scanline work item
+struct _bmodeJob
+{
+    const _bmodeConfig* cfg;
+    const _procParams* prm;
+    float* image;
+    volatile LONG rawLoaded;
+    volatile LONG rfComputed;
+    volatile LONG iqComputed;
+    volatile LONG envelopeComputed;
+    volatile LONG failed;
+};
+
+static void computeScanline(void* arg, int scanline)
+{
+    _bmodeJob* job = (_bmodeJob*)arg;
+    const _bmodeConfig& cfg = *job->cfg;
+    const _procParams& prm = *job->prm;
+    int n = cfg.layout.numSamples;
+    char fileName[RAW_MAX_PATH];
+    cacheKey rawKey, rfKey, iqKey, envKey;
+    int version;
+    short* raw = NULL;
+    float* rf = (float*)malloc(sizeof(float) * n);
+    double* iq = (double*)malloc(sizeof(double) * 2 * n);
+    float* env = job->image + (size_t)scanline * n;
+    const char* dir = cfg.cacheDir;
+    bool ok = (rf != NULL && iq != NULL);
+
+    rawFileName(cfg.prefix, scanline, fileName, sizeof(fileName));
+
+    // Chain the keys: each stage hashes the key of its input and its parameters
+    ok = ok && cacheHashFile(dir, fileName, &rawKey);
+
+    version = BMODE_RF_VERSION;
+    rfKey = cacheHashString(rawKey, "rf");
+    rfKey = cacheHash(rfKey, &version, sizeof(version));
+    rfKey = cacheHash(rfKey, &cfg.frame, sizeof(cfg.frame));
+    // The channel sum only depends on the size of the frames
+    rfKey = cacheHash(rfKey, &cfg.layout.channels, sizeof(cfg.layout.channels));
+    rfKey = cacheHash(rfKey, &cfg.layout.numSamples, sizeof(cfg.layout.numSamples));
+
+    version = BMODE_IQ_VERSION;
+    iqKey = cacheHashString(rfKey, "iq");
+    iqKey = cacheHash(iqKey, &version, sizeof(version));
+    iqKey = cacheHash(iqKey, &cfg.centerFreq, sizeof(cfg.centerFreq));
+    iqKey = cacheHash(iqKey, &cfg.filterOrder, sizeof(cfg.filterOrder));
+    // The mixing tables depend on the time of each sample
+    iqKey = cacheHash(iqKey, &cfg.layout.samplingFreq, sizeof(cfg.layout.samplingFreq));
+    iqKey = cacheHash(iqKey, &cfg.layout.speedOfSound, sizeof(cfg.layout.speedOfSound));
+    iqKey = cacheHash(iqKey, &cfg.layout.saveDelay, sizeof(cfg.layout.saveDelay));
+
+    version = BMODE_ENVELOPE_VERSION;
+    envKey = cacheHashString(iqKey, "envelope");
+    envKey = cacheHash(envKey, &version, sizeof(version));
+
+    if (ok && !cacheLoad(dir, envKey, env, sizeof(float) * n))
+    {
+        if (!cacheLoad(dir, iqKey, iq, sizeof(double) * 2 * n))
+        {
+            if (!cacheLoad(dir, rfKey, rf, sizeof(float) * n))
+            {
+                raw = (short*)malloc(sizeof(short) * cfg.layout.channels * n);
+
+                ok = (raw != NULL) &&
+                     rawReadWindow(fileName, cfg.layout, cfg.frame, 0, n, 0, cfg.layout.channels, raw);
+
+                if (ok)
+                {
+                    InterlockedIncrement(&job->rawLoaded);
+                    procChannelSum(prm, raw, rf);
+                    cacheStore(dir, rfKey, rf, sizeof(float) * n);
+                    InterlockedIncrement(&job->rfComputed);
+                }
+            }
+
+            if (ok)
+            {
+                procDemodulate(prm, rf, iq);
+                cacheStore(dir, iqKey, iq, sizeof(double) * 2 * n);
+                InterlockedIncrement(&job->iqComputed);
+            }
+        }
+
+        if (ok)
+        {
+            procMagnitude(prm, iq, env);
+            cacheStore(dir, envKey, env, sizeof(float) * n);
+            InterlockedIncrement(&job->envelopeComputed);
+        }
+    }
+
+    if (!ok)
+    {
+        InterlockedIncrement(&job->failed);
+    }
+
+    free(raw);
+    free(rf);
+    free(iq);
+}
+
+bool bmodeCompute(const _bmodeConfig& cfg, float* image, _bmodeStats* stats)
+{
+    _bmodeJob job;
+    _procParams prm;
+
+    if (!procInit(prm, cfg.layout.channels, cfg.layout.numSamples, cfg.layout.samplingFreq, cfg.centerFreq,
+                  2e-6 * cfg.layout.saveDelay / cfg.layout.speedOfSound, cfg.filterOrder))
+    {
+        return false;
+    }
+
+    job.cfg = &cfg;
+    job.prm = &prm;
+    job.image = image;
+    job.rawLoaded = job.rfComputed = job.iqComputed = job.envelopeComputed = 0;
+    job.failed = 0;
+
+    parallelFor(cfg.numOfScanlines, computeScanline, &job, cfg.numThreads);
+
+    procFree(prm);
+
+    if (job.failed > 0)
+    {
+        printf("ERROR: Could not compute %d scanlines\n", (int)job.failed);
+        return false;
+    }
+
+    // Display parameters are not cached, the compression is cheap
+    procLogCompress(image, cfg.numOfScanlines * cfg.layout.numSamples, cfg.dBRange, cfg.reject, image);
+
+    printf("B mode: %d scanlines, computed %d rf, %d iq, %d envelope\n", cfg.numOfScanlines,
+           (int)job.rfComputed, (int)job.iqComputed, (int)job.envelopeComputed);
+
+    if (stats != NULL)
+    {
+        stats->rawLoaded = job.rawLoaded;
+        stats->rfComputed = job.rfComputed;
+        stats->iqComputed = job.iqComputed;
+        stats->envelopeComputed = job.envelopeComputed;
+    }
+
+    return true;
+}
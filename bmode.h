@@ -0,0 +1,48 @@
+#pragma once
+
+#include "raw_reader.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// Configuration of the B mode image computed from one frame of a dataset.
+////////////////////////////////////////////////////////////////////////////////
+struct _bmodeConfig
+{
+    /// file name prefix, e.g. probeId_2_singleRx. "_scanline_<n>.raw" is appended
+    const char* prefix;
+    /// number of scanline files of the dataset
+    int numOfScanlines;
+    /// layout of the scanline files
+    _rawLayout layout;
+    /// frame used to form the image (4 in load_texo_raw.m, which counts from 1)
+    int frame;
+    /// demodulation frequency in Hz
+    double centerFreq;
+    /// order of the demodulation low pass filter
+    int filterOrder;
+    /// dynamic range for display in dB
+    double dBRange;
+    /// envelope level in dB shown as black
+    double reject;
+    /// directory of the intermediate products cache, which must exist
+    const char* cacheDir;
+    /// number of threads, 0 for one per processor
+    int numThreads;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Number of scanlines whose products were computed instead of read from the
+/// cache in the last call to bmodeCompute().
+////////////////////////////////////////////////////////////////////////////////
+struct _bmodeStats
+{
+    int rawLoaded;
+    int rfComputed;
+    int iqComputed;
+    int envelopeComputed;
+};
+
+/// Compute the B mode image, image[scanline * numSamples + n] from 0 to 255.
+/// The beamformed RF, IQ and envelope of each scanline are kept in the cache,
+/// so a new call only computes the stages downstream of a changed parameter
+/// and only for scanlines whose file changed
+bool bmodeCompute(const _bmodeConfig& cfg, float* image, _bmodeStats* stats = NULL);
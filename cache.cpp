@@ -0,0 +1,197 @@
+/*
+ * @brief     Content addressed on-disk cache of intermediate products
+ *
+ * @details   Each entry is a file named after its 64 bit key in the cache
+ *            directory. Keys are chained hashes: the key of a product is the
+ *            hash of the key of its input, the name of the stage and the stage
+ *            parameters. When a parameter changes, only the keys of that stage
+ *            and of the stages after it change, so everything upstream is
+ *            still found in the cache.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#ifdef _MSC_VER
+    #define cacheStat _stat64
+    typedef struct __stat64 cacheStatInfo;
+#else
+    #define cacheStat stat
+    typedef struct stat cacheStatInfo;
+#endif
+
+/// Size of the blocks read while hashing a file
+#define CACHE_READ_BLOCK (1 << 20)
+
+#define FNV_PRIME 1099511628211ULL
+
+/// Size of the name buffers of the entries
+#define CACHE_MAX_PATH 512
+
+// Name of the file of an entry. Fails when it does not fit in size characters
+static bool entryName(const char* dir, cacheKey key, char* name, size_t size)
+{
+    int len = _snprintf(name, size, "%s/%016llx.bin", dir, key);
+
+    // _snprintf does not terminate a name that does not fit
+    name[size - 1] = '\0';
+
+    if (len < 0 || (size_t)len >= size)
+    {
+        printf("ERROR: Cache directory name too long: %s\n", dir);
+        return false;
+    }
+
+    return true;
+}
+
+cacheKey cacheHash(cacheKey seed, const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        seed = (seed ^ p[i]) * FNV_PRIME;
+    }
+
+    return seed;
+}
+
+cacheKey cacheHashString(cacheKey seed, const char* str)
+{
+    return cacheHash(seed, str, strlen(str));
+}
+
+bool cacheHashFile(const char* dir, const char* fileName, cacheKey* key)
+{
+    unsigned char* block;
+    cacheStatInfo info;
+    cacheKey statKey;
+    long long size, mtime;
+    size_t count;
+    FILE* fp;
+
+    if (cacheStat(fileName, &info) != 0)
+    {
+        printf("ERROR: Could not open file %s\n", fileName);
+        return false;
+    }
+
+    size = info.st_size;
+    mtime = info.st_mtime;
+
+    statKey = cacheHashString(CACHE_SEED, "file");
+    statKey = cacheHashString(statKey, fileName);
+    statKey = cacheHash(statKey, &size, sizeof(size));
+    statKey = cacheHash(statKey, &mtime, sizeof(mtime));
+
+    if (cacheLoad(dir, statKey, key, sizeof(*key)))
+    {
+        return true;
+    }
+
+    fp = fopen(fileName, "rb");
+    block = (unsigned char*)malloc(CACHE_READ_BLOCK);
+    if (!fp || block == NULL)
+    {
+        printf("ERROR: Could not read file %s\n", fileName);
+        if (fp)
+        {
+            fclose(fp);
+        }
+        free(block);
+        return false;
+    }
+
+    *key = CACHE_SEED;
+    while ((count = fread(block, 1, CACHE_READ_BLOCK, fp)) > 0)
+    {
+        *key = cacheHash(*key, block, count);
+    }
+
+    fclose(fp);
+    free(block);
+
+    return cacheStore(dir, statKey, key, sizeof(*key));
+}
+
+bool cacheLoad(const char* dir, cacheKey key, void* data, size_t size)
+{
+    char name[CACHE_MAX_PATH];
+    FILE* fp;
+    bool ok;
+
+    if (!entryName(dir, key, name, sizeof(name)))
+    {
+        return false;
+    }
+
+    fp = fopen(name, "rb");
+    if (!fp)
+    {
+        return false;
+    }
+
+    // The entry must have exactly the expected size
+    ok = (fread(data, 1, size, fp) == size) && (fgetc(fp) == EOF);
+
+    fclose(fp);
+
+    // A damaged entry would never be replaced, since cacheStore() keeps
+    // existing entries, so remove it for the caller to store it again
+    if (!ok)
+    {
+        remove(name);
+    }
+
+    return ok;
+}
+
+bool cacheStore(const char* dir, cacheKey key, const void* data, size_t size)
+{
+    char name[CACHE_MAX_PATH], tmpName[CACHE_MAX_PATH + 32];
+    FILE* fp;
+    bool ok;
+
+    if (!entryName(dir, key, name, sizeof(name)))
+    {
+        return false;
+    }
+
+    fp = fopen(name, "rb");
+    if (fp)
+    {
+        fclose(fp);
+        return true;
+    }
+
+    // Write to a temporary file first so an interrupted run never leaves a
+    // truncated entry under a valid key
+    _snprintf(tmpName, sizeof(tmpName), "%s.%lu.tmp", name, (unsigned long)GetCurrentThreadId());
+    tmpName[sizeof(tmpName) - 1] = '\0';
+
+    fp = fopen(tmpName, "wb");
+    if (!fp)
+    {
+        printf("ERROR: Could not write to cache directory %s\n", dir);
+        return false;
+    }
+
+    ok = (fwrite(data, 1, size, fp) == size);
+    ok = (fclose(fp) == 0) && ok;
+
+    // Another thread may have stored the same entry meanwhile
+    if (!ok || rename(tmpName, name) != 0)
+    {
+        remove(tmpName);
+    }
+
+    return ok;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+
+/// Key of an entry of the cache, a 64 bit hash of its content or of the
+/// inputs and parameters that produced it
+typedef unsigned long long cacheKey;
+
+/// Seed of a new chain of hashes
+#define CACHE_SEED 14695981039346656037ULL
+
+/// Continue the hash of seed with size bytes of data (FNV-1a, 64 bits)
+cacheKey cacheHash(cacheKey seed, const void* data, size_t size);
+
+/// Continue the hash of seed with a string, without its terminator
+cacheKey cacheHashString(cacheKey seed, const char* str);
+
+/// Content hash of a file. The result is memoized in the cache directory
+/// under the path, size and modification time of the file, so files that
+/// did not change are not read again
+bool cacheHashFile(const char* dir, const char* fileName, cacheKey* key);
+
+/// Read an entry into data. Fails if the entry is missing or its size differs,
+/// or if the cache directory name is too long for the name of the entry. An
+/// entry of the wrong size is removed, so the next cacheStore() replaces it
+bool cacheLoad(const char* dir, cacheKey key, void* data, size_t size);
+
+/// Store an entry. Entries are immutable, an existing one is kept
+bool cacheStore(const char* dir, cacheKey key, const void* data, size_t size);
@@ -0,0 +1,141 @@
+/*
+ * @brief     CRC-32C checksums of dataset files
+ *
+ * @details   The SSE4.2 crc32 instruction handles 8 bytes per instruction,
+ *            which is faster than the disks the datasets are read from. The
+ *            table driven fallback (slicing by 8) is for processors without
+ *            SSE4.2. Both give the same result.
+ */
+
+#include <windows.h>
+#include <nmmintrin.h>
+
+#include "crc32c.h"
+#include "kernels.h"
+
+/// Reflected Castagnoli polynomial
+#define CRC32C_POLY 0x82F63B78
+
+// crcTable[k][b]: CRC of byte b followed by k zero bytes
+static unsigned int crcTable[8][256];
+// 0: not checked, 1: being set up, 2: ready
+static volatile LONG crcState = 0;
+static bool crcSse42 = false;
+
+static void crcSetup()
+{
+    unsigned int c;
+    int i, j, k;
+
+    if (crcState == 2)
+    {
+        return;
+    }
+
+    if (InterlockedCompareExchange(&crcState, 1, 0) != 0)
+    {
+        // Another thread does the setup
+        while (crcState != 2)
+        {
+            Sleep(0);
+        }
+        return;
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        c = i;
+        for (j = 0; j < 8; j++)
+        {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : (c >> 1);
+        }
+        crcTable[0][i] = c;
+    }
+
+    for (k = 1; k < 8; k++)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            c = crcTable[k - 1][i];
+            crcTable[k][i] = (c >> 8) ^ crcTable[0][c & 0xFF];
+        }
+    }
+
+    crcSse42 = kernelHasSse42();
+
+    MemoryBarrier();
+    crcState = 2;
+}
+
+static unsigned int crcSoftware(unsigned int crc, const unsigned char* p, size_t size)
+{
+    unsigned int lo, hi;
+
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+        hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((unsigned int)p[7] << 24);
+
+        crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^
+              crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF] ^
+              crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+    }
+
+    for (; size > 0; size--, p++)
+    {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p) & 0xFF];
+    }
+
+    return crc;
+}
+
+KERNEL_TARGET("sse4.2") static unsigned int crcSse(unsigned int crc, const unsigned char* p, size_t size)
+{
+    // Bytes up to an 8 byte boundary, then whole words
+    for (; size > 0 && ((size_t)p & 7) != 0; size--, p++)
+    {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+
+#if defined(_M_X64) || defined(__x86_64__)
+    unsigned long long c = crc;
+
+    for (; size >= 8; size -= 8, p += 8)
+    {
+        c = _mm_crc32_u64(c, *(const unsigned long long*)p);
+    }
+
+    crc = (unsigned int)c;
+#else
+    for (; size >= 4; size -= 4, p += 4)
+    {
+        crc = _mm_crc32_u32(crc, *(const unsigned int*)p);
+    }
+#endif
+
+    for (; size > 0; size--, p++)
+    {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+
+    return crc;
+}
+
+unsigned int crc32c(unsigned int crc, const void* data, size_t size)
+{
+    crcSetup();
+
+    crc = ~crc;
+    crc = crcSse42 ? crcSse(crc, (const unsigned char*)data, size)
+                   : crcSoftware(crc, (const unsigned char*)data, size);
+
+    return ~crc;
+}
+
+bool crc32cHardware()
+{
+    crcSetup();
+
+    return crcSse42;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+/// Continue the CRC-32C (Castagnoli) of crc with size bytes of data. Start a
+/// new checksum with crc = 0. Uses the SSE4.2 crc32 instruction when the
+/// processor has it and a table driven version otherwise
+unsigned int crc32c(unsigned int crc, const void* data, size_t size);
+
+/// True when crc32c() runs on the SSE4.2 instruction
+bool crc32cHardware();
@@ -0,0 +1,724 @@
+/*
+ * @brief     Ingest of legacy scanline datasets
+ *
+ * @details   Acquisitions made with saveData() are one headerless file per
+ *            scanline, described only by the text log of the acquisition. The
+ *            ingest parses the log once and packs the scanline files into a
+ *            single dataset file with a header, an index of the scanlines
+ *            (parameters, frame counts, offsets) and a CRC-32C of every part,
+ *            so a dataset is opened by reading the first few kilobytes and
+ *            checked without the log.
+ *
+ *            Conversion runs in three passes: parse the logs and lay out the
+ *            dataset files, copy every scanline file of every acquisition in
+ *            parallel (large sequential reads, checksummed while copying), then
+ *            write the headers and indices. Each dataset is written to a
+ *            temporary file and renamed when complete.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ingest.h"
+#include "crc32c.h"
+#include "parallel.h"
+
+#define INGEST_MAGIC "TXD1"
+#define INGEST_VERSION 2
+
+/// Size of the blocks read and written while copying and verifying
+#define INGEST_BLOCK (8 << 20)
+
+// Set the size of an open file, with 64 bit sizes on every compiler
+#ifdef _MSC_VER
+    #include <io.h>
+    #define ingestSetSize(fp, size) (_chsize_s(_fileno(fp), size) == 0)
+#else
+    #include <unistd.h>
+    #define ingestSetSize(fp, size) (ftruncate(fileno(fp), size) == 0)
+#endif
+
+// One acquisition being converted
+struct _ingestJob
+{
+    const char* logFileName;
+    /// log file name without .log, the prefix of the scanline files
+    char rawPrefix[512];
+    char outName[512];
+    char tmpName[520];
+    _ingestHeader header;
+    _ingestScanline index[INGEST_MAX_SCANLINES];
+    volatile LONG failed;
+};
+
+// One scanline file (or dataset entry) processed by a worker
+struct _ingestItem
+{
+    int job;
+    int entry;
+};
+
+struct _ingestConvertState
+{
+    _ingestJob* jobs;
+    _ingestItem* items;
+    const char* outDir;
+};
+
+struct _ingestVerifyState
+{
+    _ingestDataset* datasets;
+    _ingestItem* items;
+    volatile LONG* failed;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Log parsing
+////////////////////////////////////////////////////////////////////////////////
+
+static void copyString(char* dst, const char* src, size_t size)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+// Parameter lines of a scanline block: "name = value"
+static void parseParameter(const char* line, _ingestScanline& sc)
+{
+    char name[64], value[128];
+
+    if (sscanf(line, "%63[^ =] = %127[^\n]", name, value) != 2)
+    {
+        return;
+    }
+
+    if (strcmp(name, "tx.aperture") == 0)                sc.txAperture = atoi(value);
+    else if (strcmp(name, "tx.focusDistance") == 0)      sc.txFocusDistance = atoi(value);
+    else if (strcmp(name, "tx.frequency") == 0)          sc.txFrequency = atoi(value);
+    else if (strcmp(name, "tx.pulseShape") == 0)         copyString(sc.txPulseShape, value, sizeof(sc.txPulseShape));
+    else if (strcmp(name, "tx.useManualDelays") == 0)    sc.txUseManualDelays = atoi(value);
+    else if (strcmp(name, "tx.centerElement") == 0)      sc.txCenterElement = atof(value);
+    else if (strcmp(name, "rx.aperture") == 0)           sc.rxAperture = atoi(value);
+    else if (strcmp(name, "rx.acquisitionDepth") == 0)   sc.rxAcquisitionDepth = atoi(value);
+    else if (strcmp(name, "rx.saveDelay") == 0)          sc.rxSaveDelay = atoi(value);
+    else if (strcmp(name, "rx.applyFocus") == 0)         sc.rxApplyFocus = atoi(value);
+    else if (strcmp(name, "rx.decimation") == 0)         sc.rxDecimation = atoi(value);
+    else if (strcmp(name, "rx.customLineDuration") == 0) sc.rxCustomLineDuration = atoi(value);
+    else if (strcmp(name, "rx.angle") == 0)              sc.angle = atoi(value);
+    else if (strcmp(name, "rx.centerElement") == 0)      sc.rxCenterElement = atof(value);
+}
+
+bool ingestParseLog(const char* logFileName, _ingestHeader& header, _ingestScanline* index)
+{
+    char line[512];
+    bool saved[INGEST_MAX_SCANLINES];
+    _ingestScanline* sc = NULL;
+    int numEntries = 0, value, a, b, i, n;
+    size_t len;
+    FILE* fp = fopen(logFileName, "r");
+
+    if (!fp)
+    {
+        printf("ERROR: Could not open file %s\n", logFileName);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memset(index, 0, sizeof(_ingestScanline) * INGEST_MAX_SCANLINES);
+    memset(saved, 0, sizeof(saved));
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        // Logs copied from the scanner may have CRLF line ends
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        {
+            line[--len] = '\0';
+        }
+
+        if (sscanf(line, "Parameters of scanline #%d/%d", &a, &b) == 2)
+        {
+            if (numEntries == INGEST_MAX_SCANLINES)
+            {
+                printf("ERROR: More than %d scanlines in %s\n", INGEST_MAX_SCANLINES, logFileName);
+                fclose(fp);
+                return false;
+            }
+
+            sc = &index[numEntries++];
+            sc->scanline = a;
+        }
+        else if (strncmp(line, "Date and time: ", 15) == 0)
+        {
+            // The first one is the start of the acquisition
+            if (header.date[0] == '\0')
+            {
+                copyString(header.date, line + 15, sizeof(header.date));
+            }
+        }
+        else if (strncmp(line, "Probe name: ", 12) == 0)
+        {
+            copyString(header.probeName, line + 12, sizeof(header.probeName));
+        }
+        else if (strncmp(line, "Acquisition configuration: ", 27) == 0)
+        {
+            copyString(header.mode, line + 27, sizeof(header.mode));
+        }
+        else if (sscanf(line, "Probe ID: %d", &value) == 1)
+        {
+            header.probeId = value;
+        }
+        else if (sscanf(line, "Frame size = %d bytes", &value) == 1 || sscanf(line, "Frame size: %d", &value) == 1)
+        {
+            if (header.frameSize != 0 && header.frameSize != value)
+            {
+                printf("ERROR: Frame size changes during the acquisition in %s\n", logFileName);
+                fclose(fp);
+                return false;
+            }
+
+            header.frameSize = value;
+        }
+        else if (sscanf(line, "Acquired frames: %d Saved frames: %d", &a, &b) == 2)
+        {
+            if (sc != NULL)
+            {
+                sc->acquiredFrames = a;
+                sc->numFrames = b;
+            }
+        }
+        else if (sscanf(line, "channel #%d -> rx.channelMask", &value) == 1)
+        {
+            if (sc != NULL && value + 1 > sc->numLines)
+            {
+                sc->numLines = value + 1;
+            }
+        }
+        else if (sscanf(line, "Data of scanline #%d/%d saved", &a, &b) == 2)
+        {
+            for (i = 0; i < numEntries; i++)
+            {
+                saved[i] = saved[i] || (index[i].scanline == a);
+            }
+        }
+        else if (sc != NULL)
+        {
+            parseParameter(line, *sc);
+        }
+    }
+
+    fclose(fp);
+
+    // Keep only the scanlines whose file was written
+    for (i = 0, n = 0; i < numEntries; i++)
+    {
+        if (saved[i])
+        {
+            index[n++] = index[i];
+        }
+    }
+
+    if (n == 0 || header.frameSize <= 0)
+    {
+        printf("ERROR: No saved scanline or frame size in %s\n", logFileName);
+        return false;
+    }
+
+    header.numScanlines = n;
+    header.channels = index[0].numLines;
+
+    if (header.channels < 1 || header.frameSize % (header.channels * (int)sizeof(short)) != 0)
+    {
+        printf("ERROR: Frame size %d does not match %d channels in %s\n", header.frameSize, header.channels,
+               logFileName);
+        return false;
+    }
+
+    header.numSamples = header.frameSize / (header.channels * sizeof(short));
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Conversion
+////////////////////////////////////////////////////////////////////////////////
+
+static long long alignOffset(long long offset)
+{
+    return (offset + INGEST_ALIGN - 1) / INGEST_ALIGN * INGEST_ALIGN;
+}
+
+// Pass 1: parse the log, check the scanline files and lay out the dataset
+static void parseTask(void* prm, int j)
+{
+    _ingestConvertState* state = (_ingestConvertState*)prm;
+    _ingestJob& job = state->jobs[j];
+    char name[RAW_MAX_PATH];
+    const char* base;
+    long long offset, size, frames, end = 0;
+    size_t len;
+    FILE* fp;
+    bool ok;
+    int i;
+
+    job.failed = 1;
+
+    if (!ingestParseLog(job.logFileName, job.header, job.index))
+    {
+        return;
+    }
+
+    len = strlen(job.logFileName);
+    copyString(job.rawPrefix, job.logFileName, sizeof(job.rawPrefix));
+    if (len > 4 && len < sizeof(job.rawPrefix) && strcmp(job.logFileName + len - 4, ".log") == 0)
+    {
+        job.rawPrefix[len - 4] = '\0';
+    }
+
+    base = job.rawPrefix + strlen(job.rawPrefix);
+    while (base > job.rawPrefix && base[-1] != '/' && base[-1] != '\\')
+    {
+        base--;
+    }
+
+    if (strlen(state->outDir) + strlen(base) + 6 > sizeof(job.outName))
+    {
+        printf("ERROR: Output file name too long for %s\n", job.logFileName);
+        return;
+    }
+
+    sprintf(job.outName, "%s/%s.tds", state->outDir, base);
+    sprintf(job.tmpName, "%s.tmp", job.outName);
+
+    offset = alignOffset(sizeof(_ingestHeader) + sizeof(_ingestScanline) * job.header.numScanlines);
+
+    for (i = 0; i < job.header.numScanlines; i++)
+    {
+        _ingestScanline& sc = job.index[i];
+
+        rawFileName(job.rawPrefix, sc.scanline, name, sizeof(name));
+        fp = fopen(name, "rb");
+        if (!fp)
+        {
+            printf("ERROR: Could not open file %s\n", name);
+            return;
+        }
+
+        rawSeek(fp, 0, SEEK_END);
+        size = rawTell(fp);
+        fclose(fp);
+
+        // A log without the save block (old or cut) gives no frame count
+        frames = size / job.header.frameSize;
+        if (sc.numFrames == 0)
+        {
+            sc.numFrames = sc.acquiredFrames = (int)frames;
+        }
+        else if (frames < sc.numFrames)
+        {
+            printf("WARNING: %s holds %d of %d frames\n", name, (int)frames, sc.numFrames);
+            sc.numFrames = (int)frames;
+        }
+
+        sc.offset = offset;
+        sc.size = (long long)sc.numFrames * job.header.frameSize;
+        end = sc.offset + sc.size;
+        offset = alignOffset(end);
+    }
+
+    // The copy tasks write their scanlines through their own handles, so
+    // the file gets its final size now instead of growing past its end from
+    // several threads at once
+    fp = fopen(job.tmpName, "wb");
+    ok = (fp != NULL) && ingestSetSize(fp, end);
+    ok = (fp != NULL) && (fclose(fp) == 0) && ok;
+
+    if (!ok)
+    {
+        printf("ERROR: Could not create file %s\n", job.tmpName);
+        remove(job.tmpName);
+        return;
+    }
+
+    job.failed = 0;
+}
+
+// Pass 2: copy one scanline file into its dataset, computing its CRC
+static void copyTask(void* prm, int k)
+{
+    _ingestConvertState* state = (_ingestConvertState*)prm;
+    _ingestJob& job = state->jobs[state->items[k].job];
+    _ingestScanline& sc = job.index[state->items[k].entry];
+    unsigned char* block = NULL;
+    unsigned int crc = 0;
+    long long remaining = sc.size;
+    size_t count;
+    char name[RAW_MAX_PATH];
+    FILE* fpIn = NULL;
+    FILE* fpOut = NULL;
+    bool ok = false;
+
+    if (job.failed)
+    {
+        return;
+    }
+
+    rawFileName(job.rawPrefix, sc.scanline, name, sizeof(name));
+
+    fpIn = fopen(name, "rb");
+    fpOut = fopen(job.tmpName, "r+b");
+    block = (unsigned char*)malloc(INGEST_BLOCK);
+
+    if (fpIn && fpOut && block && rawSeek(fpOut, sc.offset, SEEK_SET) == 0)
+    {
+        // The blocks are large, stdio buffering would only add a copy
+        setvbuf(fpIn, NULL, _IONBF, 0);
+        setvbuf(fpOut, NULL, _IONBF, 0);
+
+        while (remaining > 0)
+        {
+            count = (remaining > INGEST_BLOCK) ? INGEST_BLOCK : (size_t)remaining;
+
+            if (fread(block, 1, count, fpIn) != count || fwrite(block, 1, count, fpOut) != count)
+            {
+                break;
+            }
+
+            crc = crc32c(crc, block, count);
+            remaining -= count;
+        }
+
+        ok = (remaining == 0);
+    }
+
+    if (fpOut && fclose(fpOut) != 0)
+    {
+        ok = false;
+    }
+
+    if (fpIn)
+    {
+        fclose(fpIn);
+    }
+
+    free(block);
+
+    if (!ok)
+    {
+        printf("ERROR: Could not copy %s to %s\n", name, job.tmpName);
+        InterlockedExchange(&job.failed, 1);
+        return;
+    }
+
+    sc.crc = crc;
+}
+
+// Pass 3: write the header and the index and put the dataset in place
+static void finishTask(void* prm, int j)
+{
+    _ingestConvertState* state = (_ingestConvertState*)prm;
+    _ingestJob& job = state->jobs[j];
+    _ingestHeader& header = job.header;
+    size_t indexSize = sizeof(_ingestScanline) * header.numScanlines;
+    bool ok = false;
+    FILE* fp;
+
+    if (job.tmpName[0] == '\0')
+    {
+        return;
+    }
+
+    if (!job.failed)
+    {
+        memcpy(header.magic, INGEST_MAGIC, 4);
+        header.version = INGEST_VERSION;
+        header.indexCrc = crc32c(0, job.index, indexSize);
+        header.headerCrc = 0;
+        header.headerCrc = crc32c(0, &header, sizeof(header));
+
+        fp = fopen(job.tmpName, "r+b");
+        if (fp)
+        {
+            ok = (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+                 (fwrite(job.index, 1, indexSize, fp) == indexSize);
+            ok = (fclose(fp) == 0) && ok;
+        }
+
+        // rename() does not replace an existing file on Windows
+        remove(job.outName);
+        ok = ok && (rename(job.tmpName, job.outName) == 0);
+
+        if (!ok)
+        {
+            printf("ERROR: Could not write file %s\n", job.outName);
+        }
+    }
+
+    if (!ok)
+    {
+        remove(job.tmpName);
+        job.failed = 1;
+    }
+}
+
+int ingestConvert(const char** logFileNames, int numLogs, const char* outDir, int numThreads)
+{
+    _ingestConvertState state;
+    int j, i, numItems = 0, numFailed = 0;
+
+    if (numLogs <= 0)
+    {
+        return 0;
+    }
+
+    state.outDir = outDir;
+    state.jobs = (_ingestJob*)calloc(numLogs, sizeof(_ingestJob));
+    state.items = (_ingestItem*)malloc(sizeof(_ingestItem) * numLogs * INGEST_MAX_SCANLINES);
+
+    if (state.jobs == NULL || state.items == NULL)
+    {
+        printf("ERROR: Not enough memory to ingest %d acquisitions\n", numLogs);
+        free(state.jobs);
+        free(state.items);
+        return numLogs;
+    }
+
+    for (j = 0; j < numLogs; j++)
+    {
+        state.jobs[j].logFileName = logFileNames[j];
+    }
+
+    parallelFor(numLogs, parseTask, &state, numThreads);
+
+    // Scanline files of all acquisitions share the workers
+    for (j = 0; j < numLogs; j++)
+    {
+        for (i = 0; !state.jobs[j].failed && i < state.jobs[j].header.numScanlines; i++)
+        {
+            state.items[numItems].job = j;
+            state.items[numItems].entry = i;
+            numItems++;
+        }
+    }
+
+    parallelFor(numItems, copyTask, &state, numThreads);
+    parallelFor(numLogs, finishTask, &state, numThreads);
+
+    for (j = 0; j < numLogs; j++)
+    {
+        numFailed += state.jobs[j].failed ? 1 : 0;
+    }
+
+    free(state.jobs);
+    free(state.items);
+
+    return numFailed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+bool ingestOpen(const char* fileName, _ingestDataset& dataset)
+{
+    _ingestHeader& header = dataset.header;
+    unsigned int headerCrc;
+    size_t indexSize;
+    FILE* fp = fopen(fileName, "rb");
+    bool ok;
+
+    dataset.index = NULL;
+    copyString(dataset.fileName, fileName, sizeof(dataset.fileName));
+
+    if (!fp)
+    {
+        printf("ERROR: Could not open file %s\n", fileName);
+        return false;
+    }
+
+    ok = (fread(&header, sizeof(header), 1, fp) == 1) && (memcmp(header.magic, INGEST_MAGIC, 4) == 0) &&
+         (header.version == INGEST_VERSION);
+
+    if (ok)
+    {
+        headerCrc = header.headerCrc;
+        header.headerCrc = 0;
+        ok = (crc32c(0, &header, sizeof(header)) == headerCrc) && (header.numScanlines > 0) &&
+             (header.numScanlines <= INGEST_MAX_SCANLINES);
+        header.headerCrc = headerCrc;
+    }
+
+    if (!ok)
+    {
+        printf("ERROR: %s is not a dataset file or its header is damaged\n", fileName);
+        fclose(fp);
+        return false;
+    }
+
+    indexSize = sizeof(_ingestScanline) * header.numScanlines;
+    dataset.index = (_ingestScanline*)malloc(indexSize);
+
+    ok = (dataset.index != NULL) && (fread(dataset.index, 1, indexSize, fp) == indexSize) &&
+         (crc32c(0, dataset.index, indexSize) == header.indexCrc);
+
+    fclose(fp);
+
+    if (!ok)
+    {
+        printf("ERROR: The index of %s is damaged\n", fileName);
+        ingestClose(dataset);
+        return false;
+    }
+
+    return true;
+}
+
+void ingestClose(_ingestDataset& dataset)
+{
+    free(dataset.index);
+    dataset.index = NULL;
+}
+
+void ingestGetLayout(const _ingestDataset& dataset, _rawLayout& layout)
+{
+    layout.channels = dataset.header.channels;
+    layout.numSamples = dataset.header.numSamples;
+    layout.samplingFreq = rawSamplingFreq(dataset.index[0].rxDecimation);
+    layout.speedOfSound = 1540;
+    layout.saveDelay = dataset.index[0].rxSaveDelay;
+}
+
+bool ingestReadFrames(const _ingestDataset& dataset, int i, int firstFrame, int numFrames, short* out)
+{
+    size_t count = (size_t)numFrames * dataset.header.frameSize;
+    long long offset;
+    FILE* fp;
+    bool ok;
+
+    if (i < 0 || i >= dataset.header.numScanlines || firstFrame < 0 || numFrames < 1 ||
+        firstFrame + numFrames > dataset.index[i].numFrames)
+    {
+        printf("ERROR: Frames %d to %d are not in entry %d of %s\n", firstFrame, firstFrame + numFrames - 1, i,
+               dataset.fileName);
+        return false;
+    }
+
+    fp = fopen(dataset.fileName, "rb");
+    if (!fp)
+    {
+        printf("ERROR: Could not open file %s\n", dataset.fileName);
+        return false;
+    }
+
+    offset = dataset.index[i].offset + (long long)firstFrame * dataset.header.frameSize;
+    ok = (rawSeek(fp, offset, SEEK_SET) == 0) &&
+         (fread(out, 1, count, fp) == count);
+
+    fclose(fp);
+
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Verification
+////////////////////////////////////////////////////////////////////////////////
+
+static void verifyTask(void* prm, int k)
+{
+    _ingestVerifyState* state = (_ingestVerifyState*)prm;
+    int f = state->items[k].job;
+    const _ingestDataset& dataset = state->datasets[f];
+    const _ingestScanline& sc = dataset.index[state->items[k].entry];
+    unsigned char* block = (unsigned char*)malloc(INGEST_BLOCK);
+    unsigned int crc = 0;
+    long long remaining = sc.size;
+    size_t count;
+    FILE* fp = fopen(dataset.fileName, "rb");
+
+    if (fp && block && rawSeek(fp, sc.offset, SEEK_SET) == 0)
+    {
+        setvbuf(fp, NULL, _IONBF, 0);
+
+        while (remaining > 0)
+        {
+            count = (remaining > INGEST_BLOCK) ? INGEST_BLOCK : (size_t)remaining;
+
+            if (fread(block, 1, count, fp) != count)
+            {
+                break;
+            }
+
+            crc = crc32c(crc, block, count);
+            remaining -= count;
+        }
+    }
+
+    if (fp)
+    {
+        fclose(fp);
+    }
+
+    free(block);
+
+    if (remaining != 0 || crc != sc.crc)
+    {
+        printf("ERROR: Scanline %d of %s is damaged\n", sc.scanline, dataset.fileName);
+        InterlockedExchange(&state->failed[f], 1);
+    }
+}
+
+int ingestVerify(const char** fileNames, int numFiles, int numThreads)
+{
+    _ingestVerifyState state;
+    int f, i, numItems = 0, numFailed = 0;
+
+    if (numFiles <= 0)
+    {
+        return 0;
+    }
+
+    state.datasets = (_ingestDataset*)calloc(numFiles, sizeof(_ingestDataset));
+    state.items = (_ingestItem*)malloc(sizeof(_ingestItem) * numFiles * INGEST_MAX_SCANLINES);
+    state.failed = (volatile LONG*)calloc(numFiles, sizeof(LONG));
+
+    if (state.datasets == NULL || state.items == NULL || state.failed == NULL)
+    {
+        printf("ERROR: Not enough memory to verify %d files\n", numFiles);
+        free(state.datasets);
+        free(state.items);
+        free((void*)state.failed);
+        return numFiles;
+    }
+
+    for (f = 0; f < numFiles; f++)
+    {
+        if (!ingestOpen(fileNames[f], state.datasets[f]))
+        {
+            state.failed[f] = 1;
+            continue;
+        }
+
+        for (i = 0; i < state.datasets[f].header.numScanlines; i++)
+        {
+            state.items[numItems].job = f;
+            state.items[numItems].entry = i;
+            numItems++;
+        }
+    }
+
+    parallelFor(numItems, verifyTask, &state, numThreads);
+
+    for (f = 0; f < numFiles; f++)
+    {
+        numFailed += state.failed[f] ? 1 : 0;
+        ingestClose(state.datasets[f]);
+    }
+
+    free(state.datasets);
+    free(state.items);
+    free((void*)state.failed);
+
+    return numFailed;
+}
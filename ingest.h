@@ -0,0 +1,112 @@
+#pragma once
+
+#include "texo_def.h"
+#include "raw_reader.h"
+
+/// Maximum number of scanline files of a dataset
+#define INGEST_MAX_SCANLINES 256
+
+/// Alignment in bytes of the scanline data in a dataset file
+#define INGEST_ALIGN 4096
+
+////////////////////////////////////////////////////////////////////////////////
+/// Entry of the index of a dataset file: one scanline file of the original
+/// acquisition, with the parameters recovered from its log.
+////////////////////////////////////////////////////////////////////////////////
+struct _ingestScanline
+{
+    /// position of the frames in the dataset file in bytes
+    long long offset;
+    /// size of the frames in bytes (numFrames * frameSize)
+    long long size;
+    double txCenterElement;
+    double rxCenterElement;
+    /// CRC-32C of the frames
+    unsigned int crc;
+    int scanline;
+    /// frames stored, and frames acquired before saving
+    int numFrames;
+    int acquiredFrames;
+    int txAperture;
+    int txFocusDistance;
+    int txFrequency;
+    int txUseManualDelays;
+    int rxAperture;
+    int rxAcquisitionDepth;
+    /// 0 in logs written before the ROI was configurable
+    int rxSaveDelay;
+    int rxApplyFocus;
+    int rxDecimation;
+    int rxCustomLineDuration;
+    int angle;
+    /// lines (channels) of each frame
+    int numLines;
+    char txPulseShape[MAXPULSESHAPESZ + 1];
+    /// keeps the size a multiple of 8 bytes
+    char reserved[7];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Header of a dataset file. It is followed by numScanlines index entries and
+/// then by the frames of each scanline, as saved by the acquisition tool.
+////////////////////////////////////////////////////////////////////////////////
+struct _ingestHeader
+{
+    char magic[4];
+    int version;
+    int probeId;
+    int frameSize;
+    int channels;
+    int numSamples;
+    int numScanlines;
+    /// CRC-32C of the index
+    unsigned int indexCrc;
+    char probeName[32];
+    char mode[16];
+    /// date and time of the acquisition as written in the log
+    char date[32];
+    /// CRC-32C of this header with headerCrc = 0
+    unsigned int headerCrc;
+    int reserved;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// An open dataset file.
+////////////////////////////////////////////////////////////////////////////////
+struct _ingestDataset
+{
+    char fileName[512];
+    _ingestHeader header;
+    _ingestScanline* index;
+};
+
+/// Recover the description of a legacy acquisition from its text log (the
+/// .log written by the acquisition tool, or journal_dump output). Fills the
+/// header and the parameters and frame counts of every saved scanline, in
+/// index, which must hold INGEST_MAX_SCANLINES entries
+bool ingestParseLog(const char* logFileName, _ingestHeader& header, _ingestScanline* index);
+
+/// Convert legacy acquisitions, given by their log files, to dataset files
+/// named after the logs in outDir. The scanline files are read next to each
+/// log. All scanline files of all acquisitions are copied and checksummed in
+/// parallel with numThreads threads (0 for one per processor). Returns the
+/// number of acquisitions that could not be converted
+int ingestConvert(const char** logFileNames, int numLogs, const char* outDir, int numThreads = 0);
+
+/// Open a dataset file: read the header and the index and check their CRCs
+bool ingestOpen(const char* fileName, _ingestDataset& dataset);
+
+/// Free the index of an open dataset
+void ingestClose(_ingestDataset& dataset);
+
+/// Layout of the frames of a dataset, for the raw_reader functions
+void ingestGetLayout(const _ingestDataset& dataset, _rawLayout& layout);
+
+/// Read numFrames whole frames of the entry i of the index, starting at
+/// firstFrame, with one sequential read
+bool ingestReadFrames(const _ingestDataset& dataset, int i, int firstFrame, int numFrames, short* out);
+
+/// Check the CRCs of the frames of every scanline of the dataset files, in
+/// parallel over all scanlines of all files. Returns the number of files that
+/// failed
+int ingestVerify(const char** fileNames, int numFiles, int numThreads = 0);
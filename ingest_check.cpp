@@ -0,0 +1,236 @@
+/*
+ * @brief     Check of the log parser and of the dataset file round trip
+ *
+ * @details   Writes the log (with CRLF line ends) and the scanline files of a
+ *            small acquisition, converts it with ingestConvert() and opens the
+ *            dataset. The header and the index must hold the parameters of the
+ *            log, including a full length pulse shape, and the frames read back
+ *            must be the bytes of the scanline files. A scanline file shorter
+ *            than its log must keep only its frames. Then a bit flipped in the
+ *            frames must fail ingestVerify() and a bit flipped in the index
+ *            must fail ingestOpen().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ingest.h"
+
+/// Size of the simulated acquisition
+#define NUM_SCANLINES 3
+#define NUM_FRAMES 5
+#define CHANNELS 4
+#define NUM_SAMPLES 100
+
+/// Frames actually in the file of the last scanline, fewer than in the log
+#define SHORT_FRAMES 3
+
+static const char* pulseShape =
+    "+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-";
+
+// Write the log of the acquisition as the acquisition tool does
+static bool writeLog(const char* fileName)
+{
+    FILE* fp = fopen(fileName, "wb");
+    int s, c;
+
+    if (!fp)
+    {
+        printf("ERROR: Could not create file %s\n", fileName);
+        return false;
+    }
+
+    fprintf(fp, "Date and time: 2024_5_17-10_42_3\r\n\r\nProbe ID: 7\r\nProbe name: L14-5/38\r\n\r\n");
+    fprintf(fp, "Acquisition configuration: singleRx\r\n\r\n");
+
+    for (s = 0; s < NUM_SCANLINES; s++)
+    {
+        fprintf(fp, "Parameters of scanline #%d/%d\r\n\r\n", s, NUM_SCANLINES);
+        fprintf(fp, "tx.aperture = 64\r\ntx.focusDistance = 30000\r\ntx.frequency = 5000000\r\n");
+        fprintf(fp, "tx.pulseShape = %s\r\ntx.useManualDelays = 1\r\n", pulseShape);
+        fprintf(fp, "rx.aperture = 64\r\nrx.acquisitionDepth = 40000\r\nrx.saveDelay = 5000\r\n");
+        fprintf(fp, "rx.applyFocus = 1\r\nrx.decimation = 1\r\nrx.customLineDuration = 200000\r\n");
+        fprintf(fp, "rx.angle = %d\r\ntx.centerElement = %f\r\nrx.centerElement = %f\r\n", s, s + 0.5, s + 0.5);
+
+        for (c = 0; c < CHANNELS; c++)
+        {
+            fprintf(fp, "channel #%d -> rx.channelMask[0] = %x\r\n", c, 1 << c);
+            fprintf(fp, "channel #%d -> rx.channelMask[1] = 0\r\n", c);
+        }
+
+        fprintf(fp, "\r\nSequence statistics:\r\nFrame size = %d bytes\r\n",
+                (int)(CHANNELS * NUM_SAMPLES * sizeof(short)));
+        fprintf(fp, "Acquired frames: %d Saved frames: %d\r\n\r\n", NUM_FRAMES + 2, NUM_FRAMES);
+        fprintf(fp, "Data of scanline #%d/%d saved\r\n", s, NUM_SCANLINES);
+    }
+
+    return fclose(fp) == 0;
+}
+
+static bool writeScanlines(const char* prefix, short* frames)
+{
+    size_t frameSamples = CHANNELS * NUM_SAMPLES;
+    char fileName[RAW_MAX_PATH];
+    size_t i, count;
+    int s;
+    FILE* fp;
+
+    srand(1);
+
+    for (i = 0; i < NUM_SCANLINES * NUM_FRAMES * frameSamples; i++)
+    {
+        frames[i] = (short)(rand() % 65536 - 32768);
+    }
+
+    for (s = 0; s < NUM_SCANLINES; s++)
+    {
+        count = ((s == NUM_SCANLINES - 1) ? SHORT_FRAMES : NUM_FRAMES) * frameSamples;
+
+        rawFileName(prefix, s, fileName, sizeof(fileName));
+        fp = fopen(fileName, "wb");
+        if (!fp || fwrite(frames + s * NUM_FRAMES * frameSamples, sizeof(short), count, fp) != count)
+        {
+            printf("ERROR: Could not write file %s\n", fileName);
+            if (fp)
+            {
+                fclose(fp);
+            }
+            return false;
+        }
+        fclose(fp);
+    }
+
+    return true;
+}
+
+// Invert one bit of a file
+static bool flipBit(const char* fileName, long long offset)
+{
+    FILE* fp = fopen(fileName, "r+b");
+    int c;
+    bool ok;
+
+    if (!fp)
+    {
+        return false;
+    }
+
+    ok = (rawSeek(fp, offset, SEEK_SET) == 0) && ((c = fgetc(fp)) != EOF) &&
+         (rawSeek(fp, offset, SEEK_SET) == 0) && (fputc(c ^ 0x10, fp) != EOF);
+
+    return (fclose(fp) == 0) && ok;
+}
+
+// Header and index against the log
+static bool checkIndex(const _ingestDataset& dataset)
+{
+    const _ingestHeader& header = dataset.header;
+    bool ok;
+    int s;
+
+    ok = header.probeId == 7 && strcmp(header.probeName, "L14-5/38") == 0 && strcmp(header.mode, "singleRx") == 0 &&
+         strcmp(header.date, "2024_5_17-10_42_3") == 0 && header.channels == CHANNELS &&
+         header.numSamples == NUM_SAMPLES && header.numScanlines == NUM_SCANLINES;
+
+    for (s = 0; ok && s < NUM_SCANLINES; s++)
+    {
+        const _ingestScanline& sc = dataset.index[s];
+
+        ok = sc.scanline == s && sc.numLines == CHANNELS && strcmp(sc.txPulseShape, pulseShape) == 0 &&
+             sc.txUseManualDelays == 1 && sc.rxCustomLineDuration == 200000 && sc.rxSaveDelay == 5000 &&
+             sc.rxAcquisitionDepth == 40000 && sc.rxDecimation == 1 && sc.angle == s &&
+             sc.txCenterElement == s + 0.5 && sc.acquiredFrames == NUM_FRAMES + 2 &&
+             sc.numFrames == ((s == NUM_SCANLINES - 1) ? SHORT_FRAMES : NUM_FRAMES) && sc.offset % INGEST_ALIGN == 0;
+    }
+
+    return ok;
+}
+
+// Frames read back against the scanline files
+static bool checkFrames(const _ingestDataset& dataset, const short* frames, short* buffer)
+{
+    size_t frameSamples = CHANNELS * NUM_SAMPLES;
+    bool ok = true;
+    int s;
+
+    for (s = 0; ok && s < NUM_SCANLINES; s++)
+    {
+        const _ingestScanline& sc = dataset.index[s];
+
+        ok = ingestReadFrames(dataset, s, 0, sc.numFrames, buffer) &&
+             memcmp(buffer, frames + s * NUM_FRAMES * frameSamples, sizeof(short) * sc.numFrames * frameSamples) == 0;
+    }
+
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* dir = (argc > 1) ? argv[1] : ".";
+    char prefix[RAW_MAX_PATH], logFileName[RAW_MAX_PATH], outFileName[RAW_MAX_PATH], fileName[RAW_MAX_PATH];
+    const char* names[1] = { logFileName };
+    short* frames = (short*)malloc(sizeof(short) * NUM_SCANLINES * NUM_FRAMES * CHANNELS * NUM_SAMPLES);
+    short* buffer = (short*)malloc(sizeof(short) * NUM_FRAMES * CHANNELS * NUM_SAMPLES);
+    _ingestDataset dataset;
+    long long dataOffset = 0;
+    bool ok, passed;
+    int s;
+
+    if (frames == NULL || buffer == NULL)
+    {
+        printf("ERROR: Not enough memory\n");
+        return -1;
+    }
+
+    sprintf(prefix, "%.480s/probeId_7_singleRx", dir);
+    sprintf(logFileName, "%s.log", prefix);
+    sprintf(outFileName, "%s.tds", prefix);
+
+    ok = writeLog(logFileName) && writeScanlines(prefix, frames) && ingestConvert(names, 1, dir) == 0;
+
+    passed = ok && ingestOpen(outFileName, dataset);
+    if (passed)
+    {
+        passed = checkIndex(dataset);
+        printf("Header and index: %s\n", passed ? "match the log" : "DIFFER");
+
+        ok = checkFrames(dataset, frames, buffer);
+        printf("Frames: %s\n", ok ? "identical" : "DIFFER");
+        passed = passed && ok;
+
+        dataOffset = dataset.index[1].offset + 1234;
+        ingestClose(dataset);
+    }
+
+    // The CRCs of the frames and of the index must catch a single bit
+    if (passed)
+    {
+        names[0] = outFileName;
+
+        ok = ingestVerify(names, 1) == 0 && flipBit(outFileName, dataOffset) && ingestVerify(names, 1) == 1;
+        printf("Bit flipped in the frames: %s\n", ok ? "detected" : "MISSED");
+        passed = ok;
+
+        ok = flipBit(outFileName, dataOffset) &&
+             flipBit(outFileName, sizeof(_ingestHeader) + sizeof(_ingestScanline) + 3) &&
+             !ingestOpen(outFileName, dataset);
+        printf("Bit flipped in the index: %s\n", ok ? "detected" : "MISSED");
+        passed = passed && ok;
+    }
+
+    for (s = 0; s < NUM_SCANLINES; s++)
+    {
+        rawFileName(prefix, s, fileName, sizeof(fileName));
+        remove(fileName);
+    }
+    remove(logFileName);
+    remove(outFileName);
+
+    free(frames);
+    free(buffer);
+
+    printf("%s\n", passed ? "Ingest check passed" : "Ingest check FAILED");
+
+    return passed ? 0 : -1;
+}
@@ -0,0 +1,158 @@
+/*
+ * @brief     Convert and verify directories of legacy acquisitions
+ *
+ * @details   convert finds the acquisition logs (*.log) of a directory and
+ *            packs each acquisition, with its scanline files, in a dataset
+ *            file (see ingest.h). verify checks the CRCs of the dataset files
+ *            of a directory, or of a single file.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ingest.h"
+
+/// Maximum number of files taken from a directory
+#define MAX_FILES 65536
+
+// Full names of the files of dir matching pattern in names, and how many in
+// count. Fails when there are more than MAX_FILES or memory runs out, with
+// count still giving the names to free
+static bool listFiles(const char* dir, const char* pattern, char** names, int& count)
+{
+    WIN32_FIND_DATAA data;
+    char search[512];
+    HANDLE find;
+    bool ok = true;
+
+    count = 0;
+
+    _snprintf(search, sizeof(search), "%s/%s", dir, pattern);
+    search[sizeof(search) - 1] = '\0';
+
+    find = FindFirstFileA(search, &data);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return true;
+    }
+
+    do
+    {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            continue;
+        }
+
+        if (count == MAX_FILES)
+        {
+            printf("ERROR: More than %d files in %s\n", MAX_FILES, dir);
+            ok = false;
+            break;
+        }
+
+        names[count] = (char*)malloc(strlen(dir) + strlen(data.cFileName) + 2);
+        if (names[count] == NULL)
+        {
+            printf("ERROR: Not enough memory\n");
+            ok = false;
+            break;
+        }
+
+        sprintf(names[count], "%s/%s", dir, data.cFileName);
+        count++;
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    char** names;
+    int numFiles, numFailed, numThreads, i;
+    bool convert, ok;
+    LARGE_INTEGER freq, start, end;
+
+    convert = (argc == 4 || argc == 5) && strcmp(argv[1], "convert") == 0;
+
+    if (!convert && !((argc == 3 || argc == 4) && strcmp(argv[1], "verify") == 0))
+    {
+        printf("Usage: %s convert [acquisition directory] [output directory] [threads]\n", argv[0]);
+        printf("       %s verify [dataset directory or file] [threads]\n\n", argv[0]);
+        printf("convert packs every acquisition of the directory (log file and scanline\n");
+        printf("files) in a dataset file with an index and CRC-32C checksums:\n\n");
+        printf("LOG: probeId_<probe ID value>_<acquisition type>.log\n");
+        printf("RAW: probeId_<probe ID value>_<acquisition type>_scanline_<scanline number>.raw\n");
+        printf("OUT: probeId_<probe ID value>_<acquisition type>.tds\n\n");
+        printf("verify checks the checksums of dataset files. By default one thread per\n");
+        printf("processor is used\n");
+
+        return -1;
+    }
+
+    numThreads = (argc == (convert ? 5 : 4)) ? atoi(argv[argc - 1]) : 0;
+
+    names = (char**)malloc(sizeof(char*) * MAX_FILES);
+    if (names == NULL)
+    {
+        printf("ERROR: Not enough memory\n");
+        return -1;
+    }
+
+    ok = listFiles(argv[2], convert ? "*.log" : "*.tds", names, numFiles);
+
+    // Not a directory: a single dataset file
+    if (ok && !convert && numFiles == 0)
+    {
+        names[0] = (char*)malloc(strlen(argv[2]) + 1);
+        ok = (names[0] != NULL);
+
+        if (ok)
+        {
+            strcpy(names[0], argv[2]);
+            numFiles = 1;
+        }
+    }
+
+    if (!ok)
+    {
+        for (i = 0; i < numFiles; i++)
+        {
+            free(names[i]);
+        }
+        free(names);
+
+        return -1;
+    }
+
+    printf("%s %d files\n", convert ? "Converting" : "Verifying", numFiles);
+    fflush(stdout);
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    if (convert)
+    {
+        numFailed = ingestConvert((const char**)names, numFiles, argv[3], numThreads);
+    }
+    else
+    {
+        numFailed = ingestVerify((const char**)names, numFiles, numThreads);
+    }
+
+    QueryPerformanceCounter(&end);
+
+    printf("%d of %d files done in %.1f s, %d failed\n", numFiles - numFailed, numFiles,
+           (double)(end.QuadPart - start.QuadPart) / freq.QuadPart, numFailed);
+
+    for (i = 0; i < numFiles; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+
+    return (numFailed == 0) ? 0 : -1;
+}
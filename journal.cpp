@@ -0,0 +1,471 @@
+/*
+ * @brief     Binary structured journal of the acquisition
+ *
+ * @details   The acquisition used to write around 140 lines of text per
+ *            scanline with fprintf while building the sequence, and to log
+ *            synchronously around stop and save. The journal instead records
+ *            one binary struct per event. journalWrite() claims a slot of a
+ *            preallocated ring with an atomic increment, copies the payload
+ *            and publishes it through the slot sequence number (bounded
+ *            multi-producer queue, no locks). A background thread writes the
+ *            published slots to the file in order. journalRender() turns the
+ *            file back into the text log or into JSON.
+ *
+ *            File layout: _journalFileHeader, then for each record a
+ *            _journalRecordHeader followed by size bytes of payload.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "journal.h"
+
+#define JOURNAL_MAGIC "TXJ1"
+#define JOURNAL_VERSION 2
+
+struct _journalFileHeader
+{
+    char magic[4];
+    int version;
+    /// units of the record times per second
+    long long ticksPerSecond;
+};
+
+struct _journalRecordHeader
+{
+    unsigned short type;
+    unsigned short size;
+    int reserved;
+    /// time since journalOpen() in ticks
+    long long time;
+};
+
+// Entry of the ring. The sequence tells who owns it: it equals the position
+// of the producer that may fill it, then position + 1 once it is published
+struct _journalSlot
+{
+    volatile LONG sequence;
+    _journalRecordHeader header;
+    unsigned char payload[JOURNAL_MAX_PAYLOAD];
+};
+
+static _journalSlot* journalSlots = NULL;
+static LONG journalMask = 0;
+static volatile LONG journalHead = 0;
+static volatile LONG journalStopping = 0;
+static HANDLE journalThread = NULL;
+static FILE* fpJournal = NULL;
+static LARGE_INTEGER journalStart;
+
+static DWORD WINAPI journalWriter(LPVOID)
+{
+    LONG tail = 0;
+    _journalSlot* slot;
+
+    for (;;)
+    {
+        slot = &journalSlots[tail & journalMask];
+
+        if (slot->sequence == tail + 1)
+        {
+            fwrite(&slot->header, sizeof(slot->header), 1, fpJournal);
+            fwrite(slot->payload, 1, slot->header.size, fpJournal);
+
+            // Hand the slot to the producer one lap ahead
+            MemoryBarrier();
+            slot->sequence = tail + journalMask + 1;
+            tail++;
+        }
+        else if (journalStopping && journalHead == tail)
+        {
+            break;
+        }
+        else
+        {
+            // Idle: make what was written so far visible and wait
+            fflush(fpJournal);
+            Sleep(1);
+        }
+    }
+
+    return 0;
+}
+
+bool journalOpen(const char* fileName, int numSlots)
+{
+    _journalFileHeader header;
+    LARGE_INTEGER freq;
+    int i;
+
+    if (numSlots < 2 || (numSlots & (numSlots - 1)) != 0)
+    {
+        printf("ERROR: The journal ring size must be a power of two\n");
+        return false;
+    }
+
+    journalSlots = (_journalSlot*)malloc(sizeof(_journalSlot) * numSlots);
+    fpJournal = fopen(fileName, "wb");
+
+    if (journalSlots == NULL || fpJournal == NULL)
+    {
+        journalClose();
+        return false;
+    }
+
+    // Large stdio buffer: the thread writes the file in big blocks
+    setvbuf(fpJournal, NULL, _IOFBF, 1 << 16);
+
+    for (i = 0; i < numSlots; i++)
+    {
+        journalSlots[i].sequence = i;
+    }
+
+    journalMask = numSlots - 1;
+    journalHead = 0;
+    journalStopping = 0;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&journalStart);
+
+    memcpy(header.magic, JOURNAL_MAGIC, 4);
+    header.version = JOURNAL_VERSION;
+    header.ticksPerSecond = freq.QuadPart;
+    fwrite(&header, sizeof(header), 1, fpJournal);
+
+    journalThread = CreateThread(NULL, 0, journalWriter, NULL, 0, NULL);
+
+    if (journalThread == NULL)
+    {
+        journalClose();
+        return false;
+    }
+
+    return true;
+}
+
+void journalWrite(int type, const void* payload, int size)
+{
+    LARGE_INTEGER now;
+    _journalSlot* slot;
+    LONG pos;
+
+    if (journalThread == NULL || size > JOURNAL_MAX_PAYLOAD)
+    {
+        return;
+    }
+
+    QueryPerformanceCounter(&now);
+
+    pos = InterlockedIncrement(&journalHead) - 1;
+    slot = &journalSlots[pos & journalMask];
+
+    // Only when the ring is full: wait for the writer to free the slot
+    while (slot->sequence != pos)
+    {
+        Sleep(0);
+    }
+
+    slot->header.type = (unsigned short)type;
+    slot->header.size = (unsigned short)size;
+    slot->header.reserved = 0;
+    slot->header.time = now.QuadPart - journalStart.QuadPart;
+
+    if (size > 0)
+    {
+        memcpy(slot->payload, payload, size);
+    }
+
+    MemoryBarrier();
+    slot->sequence = pos + 1;
+}
+
+void journalClose()
+{
+    if (journalThread != NULL)
+    {
+        journalStopping = 1;
+        WaitForSingleObject(journalThread, INFINITE);
+        CloseHandle(journalThread);
+        journalThread = NULL;
+    }
+
+    if (fpJournal != NULL)
+    {
+        fclose(fpJournal);
+        fpJournal = NULL;
+    }
+
+    free(journalSlots);
+    journalSlots = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Rendering
+////////////////////////////////////////////////////////////////////////////////
+
+static void printDate(FILE* out, const _journalDate& d)
+{
+    fprintf(out, "%d_%d_%d-%d_%d_%d", d.year, d.month, d.day, d.hour, d.minute, d.second);
+}
+
+static void printJsonString(FILE* out, const char* str, int len)
+{
+    int i;
+
+    fputc('"', out);
+    for (i = 0; i < len && str[i] != '\0'; i++)
+    {
+        if ((unsigned char)str[i] < 0x20)
+        {
+            // Control characters must be escaped in JSON
+            fprintf(out, "\\u%04x", (unsigned char)str[i]);
+            continue;
+        }
+
+        if (str[i] == '"' || str[i] == '\\')
+        {
+            fputc('\\', out);
+        }
+        fputc(str[i], out);
+    }
+    fputc('"', out);
+}
+
+// Same text the acquisition tool wrote with fprintf
+static void renderText(FILE* out, int type, const void* payload)
+{
+    const _journalStart* st = (const _journalStart*)payload;
+    const _journalScanline* sc = (const _journalScanline*)payload;
+    const _journalStats* ss = (const _journalStats*)payload;
+    const _journalCount* cn = (const _journalCount*)payload;
+    const _journalSave* sv = (const _journalSave*)payload;
+    int i;
+
+    switch (type)
+    {
+    case JOURNAL_START:
+        fprintf(out, "Date and time: ");
+        printDate(out, st->date);
+        fprintf(out, "\n\nProbe ID: %d\nProbe name: %.16s\n\n", st->probeId, st->probeName);
+        fprintf(out, "Acquisition configuration: %.16s\n\n", st->mode);
+        break;
+
+    case JOURNAL_SCANLINE:
+        fprintf(out, "--------------------------------------------------------------------------------\n");
+        fprintf(out, "Parameters of scanline #%d/%d\n", sc->scanline, sc->lastScanline);
+        fprintf(out, "\n");
+        fprintf(out, "tx.aperture = %d\n", sc->txAperture);
+        fprintf(out, "tx.focusDistance = %d\n", sc->txFocusDistance);
+        fprintf(out, "tx.frequency = %d\n", sc->txFrequency);
+        fprintf(out, "tx.pulseShape = %.100s\n", sc->txPulseShape);
+        fprintf(out, "tx.useManualDelays = %d\n", sc->txUseManualDelays);
+        fprintf(out, "rx.aperture = %d\n", sc->rxAperture);
+        fprintf(out, "rx.acquisitionDepth = %d\n", sc->rxAcquisitionDepth);
+        fprintf(out, "rx.saveDelay = %d\n", sc->rxSaveDelay);
+        fprintf(out, "rx.applyFocus = %d\n", sc->rxApplyFocus);
+        fprintf(out, "rx.decimation = %d\n", sc->rxDecimation);
+        fprintf(out, "rx.customLineDuration = %d\n", sc->rxCustomLineDuration);
+        fprintf(out, "rx.angle = %d\n", sc->angle);
+        fprintf(out, "tx.centerElement = %f\n", sc->txCenterElement);
+        fprintf(out, "rx.centerElement = %f\n", sc->rxCenterElement);
+
+        for (i = 0; i < sc->numLines && i < JOURNAL_CHANNELS; i++)
+        {
+            fprintf(out, "channel #%d -> rx.channelMask[0] = %x\n", i, sc->channelMask[i][0]);
+            fprintf(out, "channel #%d -> rx.channelMask[1] = %x\n", i, sc->channelMask[i][1]);
+        }
+        break;
+
+    case JOURNAL_STATS:
+        fprintf(out, "\nSequence statistics:\n");
+        fprintf(out, "Frame size = %d bytes\n", ss->frameSize);
+        fprintf(out, "Frame rate = %.1f fr/sec\n", ss->frameRate);
+        fprintf(out, "Buffer size = %d frames\n", ss->bufferSize);
+        fprintf(out, "Frame rate from line durations = %.1f fr/sec\n", ss->lineFrameRate);
+        // Only once the timing model was calibrated
+        if (ss->predictedFrameRate > 0)
+        {
+            fprintf(out, "Frame rate predicted offline = %.1f fr/sec (%.1f fr/sec with settling padding)\n",
+                    ss->predictedFrameRate, ss->settledFrameRate);
+        }
+        fprintf(out, "\n");
+        break;
+
+    case JOURNAL_RUNNING:
+        fprintf(out, "System running\n");
+        break;
+
+    case JOURNAL_STOP:
+        fprintf(out, "\nSTOP - Acquired (%d) frames\n", cn->count);
+        break;
+
+    case JOURNAL_STOPPED:
+        fprintf(out, "Acquisition stopped\n");
+        break;
+
+    case JOURNAL_SAVE:
+        fprintf(out, "Frame size: %d\nAcquired frames: %d ", sv->frameSize, sv->acquiredFrames);
+        fprintf(out, "Saved frames: %d\n\n", sv->savedFrames);
+        break;
+
+    case JOURNAL_SAVED:
+        fprintf(out, "Data of scanline #%d/%d saved\n", cn->count, cn->total);
+        break;
+
+    case JOURNAL_END:
+        fprintf(out, "End of acquisition.\n\nDate and time: ");
+        printDate(out, *(const _journalDate*)payload);
+        fprintf(out, "\n\n");
+        break;
+    }
+}
+
+static void renderJson(FILE* out, int type, const void* payload, double time)
+{
+    const _journalStart* st = (const _journalStart*)payload;
+    const _journalScanline* sc = (const _journalScanline*)payload;
+    const _journalStats* ss = (const _journalStats*)payload;
+    const _journalCount* cn = (const _journalCount*)payload;
+    const _journalSave* sv = (const _journalSave*)payload;
+    const _journalDate* dt = (const _journalDate*)payload;
+    int i;
+
+    fprintf(out, "{\"time\": %.6f, ", time);
+
+    switch (type)
+    {
+    case JOURNAL_START:
+        fprintf(out, "\"type\": \"start\", \"date\": \"");
+        printDate(out, st->date);
+        fprintf(out, "\", \"probeId\": %d, \"probeName\": ", st->probeId);
+        printJsonString(out, st->probeName, sizeof(st->probeName));
+        fprintf(out, ", \"mode\": ");
+        printJsonString(out, st->mode, sizeof(st->mode));
+        break;
+
+    case JOURNAL_SCANLINE:
+        fprintf(out, "\"type\": \"scanline\", \"scanline\": %d, \"lastScanline\": %d, ", sc->scanline, sc->lastScanline);
+        fprintf(out, "\"tx\": {\"aperture\": %d, \"focusDistance\": %d, \"frequency\": %d, \"pulseShape\": ",
+                sc->txAperture, sc->txFocusDistance, sc->txFrequency);
+        printJsonString(out, sc->txPulseShape, sizeof(sc->txPulseShape));
+        fprintf(out, ", \"useManualDelays\": %d, \"angle\": %d, \"centerElement\": %f}, ",
+                sc->txUseManualDelays, sc->angle, sc->txCenterElement);
+        fprintf(out, "\"rx\": {\"aperture\": %d, \"acquisitionDepth\": %d, \"saveDelay\": %d, \"applyFocus\": %d, "
+                "\"decimation\": %d, \"customLineDuration\": %d, \"angle\": %d, \"centerElement\": %f}, ",
+                sc->rxAperture, sc->rxAcquisitionDepth, sc->rxSaveDelay, sc->rxApplyFocus, sc->rxDecimation,
+                sc->rxCustomLineDuration, sc->angle, sc->rxCenterElement);
+        fprintf(out, "\"channelMask\": [");
+        for (i = 0; i < sc->numLines && i < JOURNAL_CHANNELS; i++)
+        {
+            fprintf(out, "%s[%u, %u]", (i > 0) ? ", " : "", (unsigned)sc->channelMask[i][0], (unsigned)sc->channelMask[i][1]);
+        }
+        fprintf(out, "]");
+        break;
+
+    case JOURNAL_STATS:
+        fprintf(out, "\"type\": \"stats\", \"frameSize\": %d, \"frameRate\": %.3f, \"bufferSize\": %d, "
+                "\"lineFrameRate\": %.3f, \"predictedFrameRate\": %.3f, \"settledFrameRate\": %.3f",
+                ss->frameSize, ss->frameRate, ss->bufferSize, ss->lineFrameRate, ss->predictedFrameRate,
+                ss->settledFrameRate);
+        break;
+
+    case JOURNAL_RUNNING:
+        fprintf(out, "\"type\": \"running\"");
+        break;
+
+    case JOURNAL_STOP:
+        fprintf(out, "\"type\": \"stop\", \"acquiredFrames\": %d", cn->count);
+        break;
+
+    case JOURNAL_STOPPED:
+        fprintf(out, "\"type\": \"stopped\"");
+        break;
+
+    case JOURNAL_SAVE:
+        fprintf(out, "\"type\": \"save\", \"frameSize\": %d, \"acquiredFrames\": %d, \"savedFrames\": %d",
+                sv->frameSize, sv->acquiredFrames, sv->savedFrames);
+        break;
+
+    case JOURNAL_SAVED:
+        fprintf(out, "\"type\": \"saved\", \"scanline\": %d, \"lastScanline\": %d", cn->count, cn->total);
+        break;
+
+    case JOURNAL_END:
+        fprintf(out, "\"type\": \"end\", \"date\": \"");
+        printDate(out, *dt);
+        fprintf(out, "\"");
+        break;
+
+    default:
+        fprintf(out, "\"type\": %d", type);
+        break;
+    }
+
+    fprintf(out, "}\n");
+}
+
+// Minimum payload size of each record type, 0 for none
+static size_t payloadSize(int type)
+{
+    switch (type)
+    {
+    case JOURNAL_START:    return sizeof(_journalStart);
+    case JOURNAL_SCANLINE: return sizeof(_journalScanline);
+    case JOURNAL_STATS:    return sizeof(_journalStats);
+    case JOURNAL_STOP:
+    case JOURNAL_SAVED:    return sizeof(_journalCount);
+    case JOURNAL_SAVE:     return sizeof(_journalSave);
+    case JOURNAL_END:      return sizeof(_journalDate);
+    default:               return 0;
+    }
+}
+
+bool journalRender(const char* fileName, FILE* out, bool json)
+{
+    _journalFileHeader header;
+    _journalRecordHeader record;
+    unsigned char payload[JOURNAL_MAX_PAYLOAD];
+    FILE* fp = fopen(fileName, "rb");
+    bool ok = true;
+
+    if (!fp)
+    {
+        fprintf(stderr, "ERROR: Could not open file %s\n", fileName);
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, JOURNAL_MAGIC, 4) != 0 ||
+        header.version != JOURNAL_VERSION)
+    {
+        fprintf(stderr, "ERROR: %s is not an acquisition journal\n", fileName);
+        fclose(fp);
+        return false;
+    }
+
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        if (record.size > JOURNAL_MAX_PAYLOAD || fread(payload, 1, record.size, fp) != record.size ||
+            record.size < payloadSize(record.type))
+        {
+            // A journal cut by a crash still renders up to the last record
+            fprintf(stderr, "ERROR: Truncated record in %s\n", fileName);
+            ok = false;
+            break;
+        }
+
+        if (json)
+        {
+            renderJson(out, record.type, payload, (double)record.time / header.ticksPerSecond);
+        }
+        else
+        {
+            renderText(out, record.type, payload);
+        }
+    }
+
+    fclose(fp);
+
+    return ok;
+}
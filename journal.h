@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdio.h>
+
+/// Maximum size of the payload of a journal record in bytes
+#define JOURNAL_MAX_PAYLOAD 1024
+
+/// Number of channels recorded in a scanline record
+#define JOURNAL_CHANNELS 64
+
+////////////////////////////////////////////////////////////////////////////////
+/// Types of the records of the acquisition journal.
+////////////////////////////////////////////////////////////////////////////////
+enum _journalType
+{
+    /// _journalStart: date, probe and acquisition mode
+    JOURNAL_START = 1,
+    /// _journalScanline: tx/rx parameters and channel masks of a sequence
+    JOURNAL_SCANLINE,
+    /// _journalStats: sequence statistics after texoEndSequence()
+    JOURNAL_STATS,
+    /// no payload: the sequence is running
+    JOURNAL_RUNNING,
+    /// _journalCount: frames acquired when the sequence stopped
+    JOURNAL_STOP,
+    /// no payload: stop done
+    JOURNAL_STOPPED,
+    /// _journalSave: frames written to the scanline file
+    JOURNAL_SAVE,
+    /// _journalCount: scanline saved (count = scanline, total = last scanline)
+    JOURNAL_SAVED,
+    /// _journalDate: end of the acquisition
+    JOURNAL_END
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Payloads of the records. Doubles come first so the layout has no padding.
+////////////////////////////////////////////////////////////////////////////////
+struct _journalDate
+{
+    int year, month, day, hour, minute, second;
+};
+
+struct _journalStart
+{
+    _journalDate date;
+    int probeId;
+    char probeName[16];
+    char mode[16];
+};
+
+struct _journalScanline
+{
+    double txCenterElement;
+    double rxCenterElement;
+    int scanline;
+    int lastScanline;
+    int txAperture;
+    int txFocusDistance;
+    int txFrequency;
+    int txUseManualDelays;
+    int rxAperture;
+    int rxAcquisitionDepth;
+    int rxSaveDelay;
+    int rxApplyFocus;
+    int rxDecimation;
+    int rxCustomLineDuration;
+    int angle;
+    /// number of lines added, one per channel
+    int numLines;
+    int channelMask[JOURNAL_CHANNELS][2];
+    char txPulseShape[100];
+};
+
+struct _journalStats
+{
+    double frameRate;
+    double lineFrameRate;
+    double predictedFrameRate;
+    /// predicted with the padding that lets overlapping transmits settle
+    double settledFrameRate;
+    int frameSize;
+    int bufferSize;
+};
+
+struct _journalCount
+{
+    int count;
+    int total;
+};
+
+struct _journalSave
+{
+    int frameSize;
+    int acquiredFrames;
+    int savedFrames;
+};
+
+/// Create the journal file and start the thread that writes it. Records are
+/// kept in a preallocated ring of numSlots entries (a power of two)
+bool journalOpen(const char* fileName, int numSlots = 256);
+
+/// Add a record. This only copies the payload to the ring, the file is
+/// written by the background thread. Waits only if the ring is full
+void journalWrite(int type, const void* payload = NULL, int size = 0);
+
+/// Write the pending records, stop the thread and close the file
+void journalClose();
+
+/// Render a journal file as the text log of the acquisition tool, or as one
+/// JSON object per line when json is set. Errors are printed to stderr, so a
+/// redirected output only holds the rendered records
+bool journalRender(const char* fileName, FILE* out, bool json);
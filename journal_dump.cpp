@@ -0,0 +1,30 @@
+/*
+ * @brief     Render an acquisition journal (.jrn) as text or JSON
+ *
+ * @details   The text output is the log the acquisition tool used to write
+ *            (probeId_<id>_<mode>.log). The JSON output has one object per
+ *            record, with the time in seconds since the journal was opened.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "journal.h"
+
+int main(int argc, char* argv[])
+{
+    bool json;
+
+    if (argc != 3 || (strcmp(argv[2], "text") != 0 && strcmp(argv[2], "json") != 0))
+    {
+        fprintf(stderr, "Usage: %s [journal file] [text or json]\n\n", argv[0]);
+        fprintf(stderr, "Example: %s probeId_2_singleRx.jrn text > probeId_2_singleRx.log\n", argv[0]);
+
+        return -1;
+    }
+
+    json = (strcmp(argv[2], "json") == 0);
+
+    return journalRender(argv[1], stdout, json) ? 0 : -1;
+}
@@ -0,0 +1,528 @@
+/*
+ * @brief     Processing kernels specialized at compile time
+ *
+ * @details   The channel count and the length of the demodulation filter are
+ *            fixed for a dataset, so the kernels are templates on them: the
+ *            loops over channels and taps have constant bounds and are fully
+ *            unrolled, with the taps kept in registers. Each template is
+ *            instantiated for every instruction set level and kernelSelect()
+ *            picks the right one at run time from the processor features.
+ *            Samples are always 16 bit, as stored by the acquisition.
+ *
+ *            The decimation only changes the contents of the mixing tables,
+ *            which depend on the probe center frequency and are built at run
+ *            time by procInit(), so it is not a template parameter.
+ *
+ *            All kernels are bit-exact with the scalar references: channel
+ *            sums are exact in 32 bit integers, and the SIMD versions do the
+ *            same floating point operations in the same order for each sample
+ *            (one sample per lane, no fused multiply-add). Do not build with
+ *            /fp:fast or /fp:contract, which would break this; with GCC or
+ *            clang, build with -ffp-contract=off.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#else
+    #include <cpuid.h>
+    #ifdef __clang__
+        #pragma clang fp contract(off)
+    #else
+        #pragma GCC optimize("fp-contract=off")
+    #endif
+#endif
+
+#include "kernels.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Processor features
+////////////////////////////////////////////////////////////////////////////////
+
+static void cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    unsigned int a, b, c, d;
+    __cpuid_count(leaf, 0, a, b, c, d);
+    info[0] = a;
+    info[1] = b;
+    info[2] = c;
+    info[3] = d;
+#endif
+}
+
+// Register state enabled by the OS (XCR0)
+static unsigned long long enabledState()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+_kernelIsa kernelDetectIsa()
+{
+    int info[4];
+    int maxLeaf;
+    bool osAvx, osAvx512;
+    unsigned long long xcr0;
+
+    cpuid(info, 0);
+    maxLeaf = info[0];
+
+    cpuid(info, 1);
+    if (!(info[2] & (1 << 19)))
+    {
+        return KERNEL_SCALAR;
+    }
+
+    // AVX needs OSXSAVE and the OS saving the SSE and AVX registers
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || maxLeaf < 7)
+    {
+        return KERNEL_SSE41;
+    }
+
+    xcr0 = enabledState();
+    osAvx = (xcr0 & 0x06) == 0x06;
+    osAvx512 = (xcr0 & 0xE6) == 0xE6;
+
+    cpuid(info, 7);
+
+    if (osAvx512 && (info[1] & (1 << 16)))
+    {
+        return KERNEL_AVX512;
+    }
+
+    if (osAvx && (info[1] & (1 << 5)))
+    {
+        return KERNEL_AVX2;
+    }
+
+    return KERNEL_SSE41;
+}
+
+const char* kernelIsaName(_kernelIsa isa)
+{
+    static const char* names[] = { "scalar", "SSE4.1", "AVX2", "AVX-512" };
+
+    return names[isa];
+}
+
+bool kernelHasSse42()
+{
+    int info[4];
+
+    cpuid(info, 1);
+
+    return (info[2] & (1 << 20)) != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Channel sum
+////////////////////////////////////////////////////////////////////////////////
+
+// Samples from first to the end of the line
+template <int C>
+static inline void channelSumTail(const short* frame, int numSamples, int first, float* rf)
+{
+    int n, c, sum;
+
+    for (n = first; n < numSamples; n++)
+    {
+        sum = 0;
+        for (c = 0; c < C; c++)
+        {
+            sum += frame[c * numSamples + n];
+        }
+
+        rf[n] = (float)sum;
+    }
+}
+
+/// Samples summed at a time by the scalar kernel
+#define KERNEL_SUM_BLOCK 64
+
+template <int C>
+static void channelSumScalar(const short* frame, int numSamples, float* rf)
+{
+    int sum[KERNEL_SUM_BLOCK];
+    int n = 0, c, j;
+
+    // Blocks of samples keep the reads of each channel sequential
+    for (; n + KERNEL_SUM_BLOCK <= numSamples; n += KERNEL_SUM_BLOCK)
+    {
+        for (j = 0; j < KERNEL_SUM_BLOCK; j++)
+        {
+            sum[j] = frame[n + j];
+        }
+
+        for (c = 1; c < C; c++)
+        {
+            for (j = 0; j < KERNEL_SUM_BLOCK; j++)
+            {
+                sum[j] += frame[c * numSamples + n + j];
+            }
+        }
+
+        for (j = 0; j < KERNEL_SUM_BLOCK; j++)
+        {
+            rf[n + j] = (float)sum[j];
+        }
+    }
+
+    channelSumTail<C>(frame, numSamples, n, rf);
+}
+
+template <int C>
+KERNEL_TARGET("sse4.1") static void channelSumSse41(const short* frame, int numSamples, float* rf)
+{
+    int n = 0, c;
+    __m128i sum;
+
+    for (; n + 4 <= numSamples; n += 4)
+    {
+        sum = _mm_setzero_si128();
+        for (c = 0; c < C; c++)
+        {
+            sum = _mm_add_epi32(sum, _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i*)(frame + c * numSamples + n))));
+        }
+
+        _mm_storeu_ps(rf + n, _mm_cvtepi32_ps(sum));
+    }
+
+    channelSumTail<C>(frame, numSamples, n, rf);
+}
+
+template <int C>
+KERNEL_TARGET("avx2") static void channelSumAvx2(const short* frame, int numSamples, float* rf)
+{
+    int n = 0, c;
+    __m256i sum;
+
+    for (; n + 8 <= numSamples; n += 8)
+    {
+        sum = _mm256_setzero_si256();
+        for (c = 0; c < C; c++)
+        {
+            sum = _mm256_add_epi32(sum, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(frame + c * numSamples + n))));
+        }
+
+        _mm256_storeu_ps(rf + n, _mm256_cvtepi32_ps(sum));
+    }
+
+    channelSumTail<C>(frame, numSamples, n, rf);
+}
+
+template <int C>
+KERNEL_TARGET("avx512f") static void channelSumAvx512(const short* frame, int numSamples, float* rf)
+{
+    int n = 0, c;
+    __m512i sum;
+
+    for (; n + 16 <= numSamples; n += 16)
+    {
+        sum = _mm512_setzero_si512();
+        for (c = 0; c < C; c++)
+        {
+            sum = _mm512_add_epi32(sum, _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(frame + c * numSamples + n))));
+        }
+
+        _mm512_storeu_ps(rf + n, _mm512_cvtepi32_ps(sum));
+    }
+
+    channelSumTail<C>(frame, numSamples, n, rf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Demodulation, filter and envelope
+////////////////////////////////////////////////////////////////////////////////
+
+// One output sample, same operations as procEnvelope(): the filter history
+// before the first sample is zero
+template <int T>
+static inline float envelopeSample(const double* taps, const float* cosTable, const float* sinTable,
+                                   const float* rf, int n)
+{
+    double fi = 0.0, fq = 0.0, xi, xq;
+    int k;
+
+    for (k = 0; k < T; k++)
+    {
+        xi = (n >= k) ? (double)(rf[n - k] * cosTable[n - k]) : 0.0;
+        xq = (n >= k) ? (double)(-rf[n - k] * sinTable[n - k]) : 0.0;
+        fi += taps[k] * xi;
+        fq += taps[k] * xq;
+    }
+
+    return (float)sqrt(fi * fi + fq * fq);
+}
+
+template <int T>
+static void envelopeScalar(const double* taps, const float* cosTable, const float* sinTable,
+                           int numSamples, const float* rf, float* env)
+{
+    int n;
+
+    for (n = 0; n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+}
+
+template <int T>
+KERNEL_TARGET("sse4.1") static void envelopeSse41(const double* taps, const float* cosTable, const float* sinTable,
+                                                  int numSamples, const float* rf, float* env)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128d fi, fq, t;
+    __m128 r;
+    int n, k;
+
+    // The first samples need the zero history
+    for (n = 0; n < T - 1 && n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+
+    for (; n + 2 <= numSamples; n += 2)
+    {
+        fi = fq = _mm_setzero_pd();
+
+        for (k = 0; k < T; k++)
+        {
+            r = _mm_castpd_ps(_mm_load_sd((const double*)(rf + n - k)));
+            t = _mm_set1_pd(taps[k]);
+            fi = _mm_add_pd(fi, _mm_mul_pd(t, _mm_cvtps_pd(_mm_mul_ps(r,
+                     _mm_castpd_ps(_mm_load_sd((const double*)(cosTable + n - k)))))));
+            fq = _mm_add_pd(fq, _mm_mul_pd(t, _mm_cvtps_pd(_mm_mul_ps(_mm_xor_ps(r, sign),
+                     _mm_castpd_ps(_mm_load_sd((const double*)(sinTable + n - k)))))));
+        }
+
+        _mm_store_sd((double*)(env + n), _mm_castps_pd(_mm_cvtpd_ps(
+            _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(fi, fi), _mm_mul_pd(fq, fq))))));
+    }
+
+    for (; n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+}
+
+template <int T>
+KERNEL_TARGET("avx2") static void envelopeAvx2(const double* taps, const float* cosTable, const float* sinTable,
+                                               int numSamples, const float* rf, float* env)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m256d fi, fq, t;
+    __m128 r;
+    int n, k;
+
+    for (n = 0; n < T - 1 && n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+
+    for (; n + 4 <= numSamples; n += 4)
+    {
+        fi = fq = _mm256_setzero_pd();
+
+        for (k = 0; k < T; k++)
+        {
+            r = _mm_loadu_ps(rf + n - k);
+            t = _mm256_set1_pd(taps[k]);
+            fi = _mm256_add_pd(fi, _mm256_mul_pd(t, _mm256_cvtps_pd(_mm_mul_ps(r, _mm_loadu_ps(cosTable + n - k)))));
+            fq = _mm256_add_pd(fq, _mm256_mul_pd(t, _mm256_cvtps_pd(_mm_mul_ps(_mm_xor_ps(r, sign),
+                                                                                _mm_loadu_ps(sinTable + n - k)))));
+        }
+
+        _mm_storeu_ps(env + n, _mm256_cvtpd_ps(_mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(fi, fi),
+                                                                            _mm256_mul_pd(fq, fq)))));
+    }
+
+    for (; n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+}
+
+template <int T>
+KERNEL_TARGET("avx512f") static void envelopeAvx512(const double* taps, const float* cosTable, const float* sinTable,
+                                                    int numSamples, const float* rf, float* env)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m512d fi, fq, t;
+    __m256 r;
+    int n, k;
+
+    for (n = 0; n < T - 1 && n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+
+    for (; n + 8 <= numSamples; n += 8)
+    {
+        fi = fq = _mm512_setzero_pd();
+
+        for (k = 0; k < T; k++)
+        {
+            r = _mm256_loadu_ps(rf + n - k);
+            t = _mm512_set1_pd(taps[k]);
+            fi = _mm512_add_pd(fi, _mm512_mul_pd(t, _mm512_cvtps_pd(_mm256_mul_ps(r, _mm256_loadu_ps(cosTable + n - k)))));
+            fq = _mm512_add_pd(fq, _mm512_mul_pd(t, _mm512_cvtps_pd(_mm256_mul_ps(_mm256_xor_ps(r, sign),
+                                                                                   _mm256_loadu_ps(sinTable + n - k)))));
+        }
+
+        _mm256_storeu_ps(env + n, _mm512_cvtpd_ps(_mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(fi, fi),
+                                                                               _mm512_mul_pd(fq, fq)))));
+    }
+
+    for (; n < numSamples; n++)
+    {
+        env[n] = envelopeSample<T>(taps, cosTable, sinTable, rf, n);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Delay interpolation (TFM)
+////////////////////////////////////////////////////////////////////////////////
+
+void kernelInterpolateReference(const short* line, int numSamples, const float* tofTx,
+                                const float* tofRx, float* acc, int count)
+{
+    float t;
+    int p, n;
+
+    for (p = 0; p < count; p++)
+    {
+        t = tofTx[p] + tofRx[p];
+        n = (int)t;
+
+        if (t >= 0.0f && n < numSamples - 1)
+        {
+            acc[p] += line[n] + (t - n) * (line[n + 1] - line[n]);
+        }
+    }
+}
+
+KERNEL_TARGET("avx2") static void interpolateAvx2(const short* line, int numSamples, const float* tofTx,
+                                                  const float* tofRx, float* acc, int count)
+{
+    const __m256i last = _mm256_set1_epi32(numSamples - 1);
+    __m256 t, frac, a, b;
+    __m256i i0, valid, pair;
+    int p = 0;
+
+    for (; p + 8 <= count; p += 8)
+    {
+        t = _mm256_add_ps(_mm256_loadu_ps(tofTx + p), _mm256_loadu_ps(tofRx + p));
+        i0 = _mm256_cvttps_epi32(t);
+        frac = _mm256_sub_ps(t, _mm256_cvtepi32_ps(i0));
+
+        valid = _mm256_andnot_si256(_mm256_castps_si256(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_LT_OQ)),
+                                    _mm256_cmpgt_epi32(last, i0));
+
+        // One 32 bit gather at line + n loads line[n] and line[n + 1]
+        pair = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)line, i0, valid, 2);
+        a = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16));
+        b = _mm256_cvtepi32_ps(_mm256_srai_epi32(pair, 16));
+
+        _mm256_storeu_ps(acc + p, _mm256_add_ps(_mm256_loadu_ps(acc + p),
+                                                _mm256_add_ps(a, _mm256_mul_ps(frac, _mm256_sub_ps(b, a)))));
+    }
+
+    kernelInterpolateReference(line, numSamples, tofTx + p, tofRx + p, acc + p, count - p);
+}
+
+KERNEL_TARGET("avx512f") static void interpolateAvx512(const short* line, int numSamples, const float* tofTx,
+                                                       const float* tofRx, float* acc, int count)
+{
+    const __m512i last = _mm512_set1_epi32(numSamples - 1);
+    __m512 t, frac, a, b;
+    __m512i i0, pair;
+    __mmask16 valid;
+    int p = 0;
+
+    for (; p + 16 <= count; p += 16)
+    {
+        t = _mm512_add_ps(_mm512_loadu_ps(tofTx + p), _mm512_loadu_ps(tofRx + p));
+        i0 = _mm512_cvttps_epi32(t);
+        frac = _mm512_sub_ps(t, _mm512_cvtepi32_ps(i0));
+
+        valid = _mm512_cmp_ps_mask(t, _mm512_setzero_ps(), _CMP_GE_OQ) & _mm512_cmpgt_epi32_mask(last, i0);
+
+        pair = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, i0, line, 2);
+        a = _mm512_cvtepi32_ps(_mm512_srai_epi32(_mm512_slli_epi32(pair, 16), 16));
+        b = _mm512_cvtepi32_ps(_mm512_srai_epi32(pair, 16));
+
+        _mm512_storeu_ps(acc + p, _mm512_add_ps(_mm512_loadu_ps(acc + p),
+                                                _mm512_add_ps(a, _mm512_mul_ps(frac, _mm512_sub_ps(b, a)))));
+    }
+
+    kernelInterpolateReference(line, numSamples, tofTx + p, tofRx + p, acc + p, count - p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////
+
+template <int C>
+static KERNEL_CHANNEL_SUM channelSumFor(_kernelIsa isa)
+{
+    switch (isa)
+    {
+    case KERNEL_AVX512: return channelSumAvx512<C>;
+    case KERNEL_AVX2:   return channelSumAvx2<C>;
+    case KERNEL_SSE41:  return channelSumSse41<C>;
+    default:            return channelSumScalar<C>;
+    }
+}
+
+template <int T>
+static KERNEL_ENVELOPE envelopeFor(_kernelIsa isa)
+{
+    switch (isa)
+    {
+    case KERNEL_AVX512: return envelopeAvx512<T>;
+    case KERNEL_AVX2:   return envelopeAvx2<T>;
+    case KERNEL_SSE41:  return envelopeSse41<T>;
+    default:            return envelopeScalar<T>;
+    }
+}
+
+void kernelSelect(int channels, int numTaps, _kernelIsa isa, _kernelSet& set)
+{
+    _kernelIsa detected = kernelDetectIsa();
+
+    set.isa = (isa > detected) ? detected : isa;
+
+    switch (channels)
+    {
+    case 32: set.channelSum = channelSumFor<32>(set.isa); break;
+    case 64: set.channelSum = channelSumFor<64>(set.isa); break;
+    default: set.channelSum = NULL; break;
+    }
+
+    switch (numTaps)
+    {
+    case 3: set.envelope = envelopeFor<3>(set.isa); break;
+    case 5: set.envelope = envelopeFor<5>(set.isa); break;
+    case 9: set.envelope = envelopeFor<9>(set.isa); break;
+    default: set.envelope = NULL; break;
+    }
+
+    switch (set.isa)
+    {
+    case KERNEL_AVX512: set.interpolate = interpolateAvx512; break;
+    case KERNEL_AVX2:   set.interpolate = interpolateAvx2; break;
+    // Without gathers the compiled reference is faster than SSE
+    default:            set.interpolate = kernelInterpolateReference; break;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Functions using an instruction set above the build target are marked with
+// it. Only gcc and clang need this
+#ifdef _MSC_VER
+    #define KERNEL_TARGET(isa)
+#else
+    #define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Instruction set levels of the specialized processing kernels.
+////////////////////////////////////////////////////////////////////////////////
+enum _kernelIsa
+{
+    KERNEL_SCALAR = 0,
+    KERNEL_SSE41,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+/// Sum the lines of all channels of a frame, rf[n] = sum of frame[c * numSamples + n]
+typedef void (*KERNEL_CHANNEL_SUM)(const short* frame, int numSamples, float* rf);
+
+/// Demodulate (mix with cosTable/sinTable), low pass filter and take the
+/// magnitude of a line. env must not be the same buffer as rf
+typedef void (*KERNEL_ENVELOPE)(const double* taps, const float* cosTable, const float* sinTable,
+                                int numSamples, const float* rf, float* env);
+
+/// Add to acc[p] the line interpolated at sample tofTx[p] + tofRx[p] (TFM)
+typedef void (*KERNEL_INTERPOLATE)(const short* line, int numSamples, const float* tofTx,
+                                   const float* tofRx, float* acc, int count);
+
+////////////////////////////////////////////////////////////////////////////////
+/// Kernels selected for a channel count and filter length. A NULL entry means
+/// there is no specialization and the scalar reference must be used.
+////////////////////////////////////////////////////////////////////////////////
+struct _kernelSet
+{
+    KERNEL_CHANNEL_SUM channelSum;
+    KERNEL_ENVELOPE envelope;
+    KERNEL_INTERPOLATE interpolate;
+    /// instruction set of the selected kernels
+    _kernelIsa isa;
+};
+
+/// Highest instruction set supported by the processor and the OS
+_kernelIsa kernelDetectIsa();
+
+/// Name of an instruction set level, for messages
+const char* kernelIsaName(_kernelIsa isa);
+
+/// True when the processor has the SSE4.2 instructions (crc32)
+bool kernelHasSse42();
+
+/// Select the kernels instantiated for channels and numTaps using at most the
+/// given instruction set. Channel counts of 32 and 64 and filters of 3, 5 and
+/// 9 taps are specialized; the interpolation does not depend on either
+void kernelSelect(int channels, int numTaps, _kernelIsa isa, _kernelSet& set);
+
+/// Scalar reference of the interpolation kernel. Every specialized kernel
+/// gives bit-exact the same results as its reference
+void kernelInterpolateReference(const short* line, int numSamples, const float* tofTx,
+                                const float* tofRx, float* acc, int count);
+
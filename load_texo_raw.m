@@ -48,12 +48,14 @@ fc = 9.5e6; % f central
 fs = 40e6; % f sampling
 fNyq = fs/2;
 depth = 5e-2; % em metros
+roiStart = 0; % ROI start (rx.saveDelay) em metros, 0 without ROI
+roiEnd = depth; % ROI end em metros, depth without ROI
 
 b = fir1(2, fc/2/fNyq);
 
 rf = zeros(numOfScanlines, nPoints);
 envelope = zeros(numOfScanlines, nPoints);
-t = linspace(0,2*depth/1540, nPoints);
+t = linspace(2*roiStart/1540,2*roiEnd/1540, nPoints);
 
 
 for scanline=1:numOfScanlines,
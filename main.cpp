@@ -14,6 +14,10 @@
  *
  * @date      21 March 2018
  *
+ *            The singleTx option fires one element at a time instead and
+ *            stores the full transmit/receive matrix, which is reconstructed
+ *            offline with the total focusing method (see tfm.h).
+ *
  * @todo      Improve aperture configuration
  *
  * @sa        http://www.ultrasonix.com/wikisonix/index.php?title=Texo
@@ -33,6 +37,9 @@
 #include <texo.h>
 #include <texo_def.h>
 
+#include "timing.h"
+#include "journal.h"
+
 #define BUILD_TIME "21 Mar 2018, 08:01"
 
 #ifndef FIRMWARE_PATH
@@ -48,6 +55,9 @@
 /// Steer angle for spatial compound imaging [mili degrees]
 #define COMPOUND_ANGLE (0)
 
+/// Maximum number of lines of a sequence (one per channel)
+#define MAX_SEQUENCE_LINES 64
+
 // Functions that come from the demo
 /// Activate probe connector
 bool selectProbe(int connector);
@@ -65,6 +75,8 @@ int newImage(void*, unsigned char*, int);
 void printStats();
 /// Write acquired data to a file
 bool saveData(char* argv[]);
+/// Copy localTime to a journal date
+void journalDate(_journalDate& date);
 
 // Status variables
 bool running = false;
@@ -72,7 +84,7 @@ bool validprobe = false;
 bool validsequence = false;
 
 // Sequencing flags
-bool singleTx = false;    // Not used
+bool singleTx = false;    // Fire one element at a time (full matrix capture)
 bool singleRx = false;    // Store data of only one channel
 bool phasedArray = false; // Phased array beamforming
 bool planeWave = false;   // Not used
@@ -92,11 +104,20 @@ char scanline_buf[4];
 // ID of the chosen probe
 int probeId = 11;
 
+// Lines of the current sequence, for the offline timing model
+_timingLine seqLines[MAX_SEQUENCE_LINES];
+int numSeqLines = 0;
+// Offline timing model, fitted to the frame rate of the first sequence
+_timingModel seqModel;
+bool seqModelReady = false;
+// Sum of the line durations reported by texoAddLine [microseconds]
+int seqLineDuration = 0;
+
 // Used during files creation
 SYSTEMTIME localTime;
 
 char logFileName[256];
-FILE *fpLog = NULL;
+bool journalOpened = false;
 
 int main(int argc, char* argv[])
 {
@@ -122,9 +143,9 @@ int main(int argc, char* argv[])
         printf("be used by changing the program. Each sequence will acquire the signals of all\n");
         printf("channels, but one at a time and save them in a file. This is repeated until all\n");
         printf("are acquired. There's one saved raw file for each scanline with up to 16\n");
-        printf("repetitions. A log file with similar name is also created. The names of the\n");
-        printf("files have the following structure:\n\n");
-        printf("LOG: probeId_<probe ID value>_<acquisition type>.log\n");
+        printf("repetitions. A journal file with similar name is also created (render it as\n");
+        printf("text with journal_dump). The names of the files have the following structure:\n\n");
+        printf("JRN: probeId_<probe ID value>_<acquisition type>.jrn\n");
         printf("RAW: probeId_<probe ID value>_<acquisition type>_scanline_<scanline number>.raw\n\n");
         printf("and the content of the file has the following structure:\n\n");
         printf("<channel 0 signal><channel 1 signal>...<channel 63 signal>\n\n");
@@ -132,21 +153,24 @@ int main(int argc, char* argv[])
         printf("Usage: %s [options] [configuration file]\n\n", argv[0]);
         printf("Options:\n");
         printf("phasedArray : performs phased array beamforming with probe SA4-2/24\n");
-        printf("singleRx : performs linear beamforming with probes L9-4/38, C5-2/60 and EC9-5/10\n\n");
+        printf("singleRx : performs linear beamforming with probes L9-4/38, C5-2/60 and EC9-5/10\n");
+        printf("singleTx : fires one element at a time and stores all channels (full matrix\n");
+        printf("           capture) for total focusing reconstruction. One file per element\n\n");
         printf("Configuration file information:\n");
 
         return -1;
     }
 
     // Check options
-    if ((strcmp(argv[1], "phasedArray") != 0) && (strcmp(argv[1], "singleRx") != 0)) {
-		printf("ERROR: Unsupported acquisition mode. Options: phasedArray or singleRx\n");
+    if ((strcmp(argv[1], "phasedArray") != 0) && (strcmp(argv[1], "singleRx") != 0) &&
+    		(strcmp(argv[1], "singleTx") != 0)) {
+		printf("ERROR: Unsupported acquisition mode. Options: phasedArray, singleRx or singleTx\n");
 		fflush(stdout);
 
 		return -1;
 	}
 
-    // Used in log file
+    // Used in journal file
     GetLocalTime(&localTime);
 
     strcpy(fwpath, FIRMWARE_PATH);
@@ -190,22 +214,26 @@ int main(int argc, char* argv[])
 
     texoGetProbeName(connector, probeName, PROBE_NAME_LEN);
 
-    sprintf(logFileName, "probeId_%d_%s.log", probeId, argv[1]);
+    // Binary journal, rendered as the text log with journal_dump
+    sprintf(logFileName, "probeId_%d_%s.jrn", probeId, argv[1]);
 
-	fpLog = fopen(logFileName, "w");
+	journalOpened = journalOpen(logFileName);
 
-	if (fpLog == NULL) {
-		printf("ERROR: Error. Cannot create log file. Check system permissions\n");
+	if (journalOpened == false) {
+		printf("ERROR: Error. Cannot create journal file. Check system permissions\n");
 		printf("ERROR: Aborting execution\n");
 		fflush(stdout);
 
 		goto goodbye;
 	} else {
-		fprintf(fpLog, "Date and time: %d_%d_%d-%d_%d_%d\n\n", localTime.wYear,
-				localTime.wMonth, localTime.wDay, localTime.wHour, localTime.wMinute, localTime.wSecond);
-		fprintf(fpLog, "Probe ID: %d\nProbe name: %s\n\n", probeId, probeName);
-		fprintf(fpLog, "Acquisition configuration: %s\n\n", argv[1]);
-		fflush(fpLog);
+		_journalStart start;
+
+		memset(&start, 0, sizeof(start));
+		journalDate(start.date);
+		start.probeId = probeId;
+		strncpy(start.probeName, probeName, sizeof(start.probeName) - 1);
+		strncpy(start.mode, argv[1], sizeof(start.mode) - 1);
+		journalWrite(JOURNAL_START, &start, sizeof(start));
 	}
 
 	// Compute the number of scanlines
@@ -235,6 +263,19 @@ int main(int argc, char* argv[])
 
 		printf("Single Rx mode. Number of scanlines = %d\n", numOfScanlines);
 	}
+	else if (strcmp(argv[1], "singleTx") == 0) {
+		singleTx = true;
+
+		singleRx = false;
+		phasedArray = false;
+		planeWave = false;
+		flashlight = false;
+
+		// One scanline per transmit element of the receive aperture
+		numOfScanlines = channels;
+
+		printf("Single Tx mode. Number of transmit elements = %d\n", numOfScanlines);
+	}
 
 //	vcaInfo.amplification = vcaAmplification; // Linear 10, Convexo 1, Phased 0
 //	vcaInfo.LPF = 1;
@@ -273,7 +314,7 @@ int main(int argc, char* argv[])
 
 			goto goodbye;
 		} else {
-			fprintf(fpLog, "System running\n");
+			journalWrite(JOURNAL_RUNNING);
 			printf("System running\n\n");
 			Sleep(2000);
 		}
@@ -286,7 +327,7 @@ int main(int argc, char* argv[])
 
 			goto goodbye;
 		} else {
-			fprintf(fpLog, "Acquisition stopped\n");
+			journalWrite(JOURNAL_STOPPED);
 			printf("Acquisition stopped\n\n");
 			Sleep(1000);
 		}
@@ -299,7 +340,8 @@ int main(int argc, char* argv[])
 
 			goto goodbye;
 		} else {
-			fprintf(fpLog, "Data of scanline #%d/%d saved\n", scanline, numOfScanlines - 1);
+			_journalCount saved = { scanline, numOfScanlines - 1 };
+			journalWrite(JOURNAL_SAVED, &saved, sizeof(saved));
 			printf("Data of scanline #%d/%d saved\n\n", scanline, numOfScanlines - 1);
 			Sleep(3000);
 		}
@@ -309,39 +351,92 @@ goodbye:
     // clean up
     texoShutdown();
 
-    GetLocalTime(&localTime);
-    fprintf(fpLog, "End of acquisition.\n\nDate and time: %d_%d_%d-%d_%d_%d\n\n", localTime.wYear,
-    				localTime.wMonth, localTime.wDay, localTime.wHour, localTime.wMinute, localTime.wSecond);
+    // Close journal file
+    if (journalOpened) {
+    	_journalDate end;
 
-    // Close log file
-    if (fpLog != NULL) {
-    	fclose(fpLog);
+    	GetLocalTime(&localTime);
+    	journalDate(end);
+    	journalWrite(JOURNAL_END, &end, sizeof(end));
+    	journalClose();
     }
 
     return 0;
 }
 
+void journalDate(_journalDate& date)
+{
+	date.year = localTime.wYear;
+	date.month = localTime.wMonth;
+	date.day = localTime.wDay;
+	date.hour = localTime.wHour;
+	date.minute = localTime.wMinute;
+	date.second = localTime.wSecond;
+}
+
 // Statistics printout for after sequence has been loaded and not running yet
 void printStats()
 {
 	int statsFrameSize = 0, statsFrameCount = 0;
-	double statsFrameRate = 0;
+	double statsFrameRate = 0, predictedFrameRate = 0, settledFrameRate = 0, reportedFrameRate = 0;
+	double settledDuration;
+	int padding[MAX_SEQUENCE_LINES];
 
 	statsFrameSize = texoGetFrameSize();
 	statsFrameRate = texoGetFrameRate();
 	statsFrameCount = texoGetMaxFrameCount();
 
+	// Compare with the line durations and, once its constants were fitted to
+	// a measured frame rate, with the offline model (see timing.h)
+	if (!seqModelReady)
+	{
+		timingDefaultModel(seqModel);
+		seqModelReady = true;
+	}
+
+	if (seqModel.calibrated && numSeqLines > 0)
+	{
+		predictedFrameRate = 1e9 / timingSequenceDuration(seqModel, seqLines, numSeqLines);
+
+		// Texo does not wait for overlapping transmits to settle, this is the
+		// rate with the customLineDuration padding that would make it wait
+		settledDuration = timingSettle(seqModel, seqLines, numSeqLines, NULL, padding);
+		settledFrameRate = (settledDuration > 0) ? 1e9 / settledDuration : 0;
+	}
+
+	reportedFrameRate = (seqLineDuration > 0) ? 1e6 / seqLineDuration : 0;
+
     // print out sequence statistics
     printf("sequence statistics:\n");
     printf("frame size = %d bytes\n", statsFrameSize);
     printf("frame rate = %.1f fr/sec\n", statsFrameRate);
-    printf("buffer size = %d frames\n\n", statsFrameCount);
+    printf("buffer size = %d frames\n", statsFrameCount);
+    printf("frame rate from line durations = %.1f fr/sec\n", reportedFrameRate);
+
+    if (predictedFrameRate > 0)
+    {
+        printf("frame rate predicted offline = %.1f fr/sec (%.1f fr/sec with settling padding)\n",
+               predictedFrameRate, settledFrameRate);
+    }
+    else if (numSeqLines > 0 && statsFrameRate > 0)
+    {
+        // Fit the model now, later sequences get a prediction
+        timingCalibrate(seqModel, seqLines, numSeqLines, statsFrameRate);
+        printf("timing model calibrated, line overhead = %d ns\n", seqModel.lineOverhead);
+    }
+
+    printf("\n");
 
     // Log sequence statistics
-    fprintf(fpLog, "\nSequence statistics:\n");
-    fprintf(fpLog, "Frame size = %d bytes\n", statsFrameSize);
-    fprintf(fpLog, "Frame rate = %.1f fr/sec\n", statsFrameRate);
-    fprintf(fpLog, "Buffer size = %d frames\n\n", statsFrameCount);
+    _journalStats stats;
+
+    stats.frameSize = statsFrameSize;
+    stats.frameRate = statsFrameRate;
+    stats.bufferSize = statsFrameCount;
+    stats.lineFrameRate = reportedFrameRate;
+    stats.predictedFrameRate = predictedFrameRate;
+    stats.settledFrameRate = settledFrameRate;
+    journalWrite(JOURNAL_STATS, &stats, sizeof(stats));
 }
 
 // Selects a probe, the function will fail if the connector is invalid or if
@@ -394,7 +489,8 @@ bool stop()
     {
         running = false;
         fprintf(stdout, "acquired (%d) frames\n", texoGetCollectedFrameCount());
-        fprintf(fpLog, "\nSTOP - Acquired (%d) frames\n", texoGetCollectedFrameCount());
+        _journalCount acquired = { texoGetCollectedFrameCount(), 0 };
+        journalWrite(JOURNAL_STOP, &acquired, sizeof(acquired));
         return true;
     }
 
@@ -422,7 +518,14 @@ bool setup(char* argv[])
         return false;
     }
 
-    createSequence(argv);
+    numSeqLines = 0;
+    seqLineDuration = 0;
+
+    // An invalid configuration must stop the acquisition
+    if (!createSequence(argv))
+    {
+        return false;
+    }
 
     // tell program to finish sequence
     if (texoEndSequence() == -1)
@@ -448,6 +551,7 @@ bool createSequence(char* argv[])
     _texoTransmitParams tx;
     _texoReceiveParams rx;
     _texoLineInfo li;
+    _journalScanline record;
 
     // Parameters that come from configuration file
 	char txPulseShape[MAXPULSESHAPESZ + 1];
@@ -456,6 +560,10 @@ bool createSequence(char* argv[])
 	int txFrequency = 0;
 	int rxAcquisitionDepth = 0;
 	int rxDecimation = 0;
+	// Optional depth window (ROI). roiEnd = 0 keeps the whole acquisition depth
+	int roiStart = 0;
+	int roiEnd = 0;
+	int numRoiValues = 0;
 
 	FILE *fpCfg = NULL;
 
@@ -472,7 +580,21 @@ bool createSequence(char* argv[])
 		fscanf(fpCfg, "%d%d%d%s%d%d", &txFocusDistance, &useCustomTxFrequency,
 				&txFrequency, txPulseShape, &rxAcquisitionDepth, &rxDecimation);
 
+		// Older configuration files do not have the ROI, keep the defaults
+		numRoiValues = fscanf(fpCfg, "%d%d", &roiStart, &roiEnd);
+
 		fclose(fpCfg);
+
+		if (numRoiValues == 1) {
+			printf("ERROR: Incomplete ROI. Enter both roiStart and roiEnd (0 for rx.acquisitionDepth)\n");
+			fflush(stdout);
+
+			return false;
+		}
+		else if (numRoiValues != 2) {
+			roiStart = 0;
+			roiEnd = 0;
+		}
 	}
 
 	// Validate some of the parameters
@@ -499,9 +621,21 @@ bool createSequence(char* argv[])
         return false;
     }
 
-    fprintf(fpLog, "--------------------------------------------------------------------------------\n");
-    fprintf(fpLog, "Parameters of scanline #%d/%d\n", scanline, numOfScanlines - 1);
-    fprintf(fpLog, "\n");
+    if (roiEnd == 0) {
+    	roiEnd = rxAcquisitionDepth;
+    }
+
+    if (roiStart < 0 || roiStart >= roiEnd || roiEnd > rxAcquisitionDepth) {
+        printf("ERROR: Invalid ROI entered. Must satisfy 0 <= start < end <= RX depth\n");
+        fflush(stdout);
+
+        return false;
+    }
+
+    // Parameters are journaled once, after the lines are added
+    memset(&record, 0, sizeof(record));
+    record.scanline = scanline;
+    record.lastScanline = numOfScanlines - 1;
 
     tx.centerElement = 0;
     // use aperture of 0 to set for single element transmit
@@ -534,12 +668,15 @@ bool createSequence(char* argv[])
     rx.aperture = channels;
     rx.angle = 0;
     rx.maxApertureDepth = 30000;
-    rx.acquisitionDepth = rxAcquisitionDepth * 1000;
-    rx.saveDelay = 0;
+    // Only the ROI is acquired and saved: the line stops at its end and the
+    // samples before its start are dropped by the hardware
+    rx.acquisitionDepth = roiEnd * 1000;
+    rx.saveDelay = roiStart * 1000;
     rx.speedOfSound = 1540;
     rx.channelMask[0] = rx.channelMask[1] = 0xFFFFFFFF;
-    // for single element receive, don't use a focusing scheme
-    rx.applyFocus = 1; // Previously: singleRx ? 0 : 1;
+    // for single element receive, don't use a focusing scheme. Full matrix
+    // capture must store unfocused channel data for the TFM reconstruction
+    rx.applyFocus = singleTx ? 0 : 1; // Previously: singleRx ? 0 : 1;
     rx.useManualDelays = 0;
     // 0 sets sampling frequency to 40 MHz; 1 to 20 MHz; 2 to 10 MHz
     rx.decimation = rxDecimation;
@@ -549,16 +686,17 @@ bool createSequence(char* argv[])
     // adjust the line duration if triggering DAQ in flashlight mode
     rx.customLineDuration = flashlight ? 200000 : 0; // 200 usec
 
-    fprintf(fpLog, "tx.aperture = %d\n", tx.aperture);
-    fprintf(fpLog, "tx.focusDistance = %d\n", tx.focusDistance);
-    fprintf(fpLog, "tx.frequency = %d\n", tx.frequency);
-    fprintf(fpLog, "tx.pulseShape = %s\n", tx.pulseShape);
-    fprintf(fpLog, "tx.useManualDelays = %d\n", tx.useManualDelays);
-    fprintf(fpLog, "rx.aperture = %d\n", rx.aperture);
-    fprintf(fpLog, "rx.acquisitionDepth = %d\n", rx.acquisitionDepth);
-    fprintf(fpLog, "rx.applyFocus = %d\n", rx.applyFocus);
-    fprintf(fpLog, "rx.decimation = %d\n", rx.decimation);
-    fprintf(fpLog, "rx.customLineDuration = %d\n", rx.customLineDuration);
+    record.txAperture = tx.aperture;
+    record.txFocusDistance = tx.focusDistance;
+    record.txFrequency = tx.frequency;
+    strncpy(record.txPulseShape, tx.pulseShape, sizeof(record.txPulseShape) - 1);
+    record.txUseManualDelays = tx.useManualDelays;
+    record.rxAperture = rx.aperture;
+    record.rxAcquisitionDepth = rx.acquisitionDepth;
+    record.rxSaveDelay = rx.saveDelay;
+    record.rxApplyFocus = rx.applyFocus;
+    record.rxDecimation = rx.decimation;
+    record.rxCustomLineDuration = rx.customLineDuration;
 
     // set the window type of the receive aperture and the receive aperture curve
     // Configuration set in the demo
@@ -568,6 +706,19 @@ bool createSequence(char* argv[])
     rx.rxAprCrv.btm = 100;
     rx.rxAprCrv.vmid = 50;
 
+    // The full matrix is summed without weights by tfmReconstruct(), so every
+    // channel must keep its raw samples at all depths: rectangular window and
+    // the whole aperture open from the transducer face
+    if (singleTx)
+    {
+        rx.weightType = 0;
+        rx.useCustomWindow = 0;
+        rx.rxAprCrv.top = 100;
+        rx.rxAprCrv.mid = 100;
+        rx.rxAprCrv.btm = 100;
+        rx.rxAprCrv.vmid = 50;
+    }
+
     elements = texoGetProbeNumElements();
     // for phased array
     min = -45000;
@@ -583,18 +734,26 @@ bool createSequence(char* argv[])
         // compute angle
         rx.angle = tx.angle = min + (((max - min) * scanline) / (elements - 1));
 
-        fprintf(fpLog, "rx.angle = %d\n", rx.angle);
+    }
+    else if (singleTx)
+    {
+    	// The receive aperture stays on the first channels elements while
+    	// the transmit element walks through it, one per scanline
+    	tx.centerElement = scanline + 0.5;
+    	rx.centerElement = (channels / 2) + 0.5;
+
+    	rx.angle = tx.angle = 0;
     }
     else {
     	tx.centerElement = (channels / 2) + (scanline) + 0.5;
     	rx.centerElement = (channels / 2) + (scanline) + 0.5;
 
     	rx.angle = tx.angle = COMPOUND_ANGLE;
-    	fprintf(fpLog, "rx.angle = %d\n", rx.angle);
     }
 
-    fprintf(fpLog, "tx.centerElement = %f\n", tx.centerElement);
-    fprintf(fpLog, "rx.centerElement = %f\n", rx.centerElement);
+    record.angle = rx.angle;
+    record.txCenterElement = tx.centerElement;
+    record.rxCenterElement = rx.centerElement;
 
     for (i = 0; i < channels; i++)
     {
@@ -602,21 +761,37 @@ bool createSequence(char* argv[])
 		rx.channelMask[0] = (c < 32) ? (1 << c) : 0;
 		rx.channelMask[1] = (c >= 32) ? (1 << (c - 32)) : 0;
 
-        fprintf(fpLog, "channel #%d -> rx.channelMask[0] = %x\n", i, rx.channelMask[0]);
-        fprintf(fpLog, "channel #%d -> rx.channelMask[1] = %x\n", i, rx.channelMask[1]);
+        if (i < JOURNAL_CHANNELS)
+        {
+        	record.channelMask[i][0] = rx.channelMask[0];
+        	record.channelMask[i][1] = rx.channelMask[1];
+        	record.numLines = i + 1;
+        }
 
         if (!texoAddLine(tx, rx, li))
         {
+        	journalWrite(JOURNAL_SCANLINE, &record, sizeof(record));
             return false;
         }
+
+        seqLineDuration += li.lineDuration;
+
+        if (numSeqLines < MAX_SEQUENCE_LINES)
+        {
+        	seqLines[numSeqLines].tx = tx;
+        	seqLines[numSeqLines].rx = rx;
+        	numSeqLines++;
+        }
     }
 
+    journalWrite(JOURNAL_SCANLINE, &record, sizeof(record));
+
     return true;
 }
 
-// Store data to disk. Create a file with data and another file with logs
+// Store data to disk. Create a file with data and journal the save
 // The filenames follow a template that includes the probe and the acquisition.
-// Log file name is defined in main. Data file name is defined inside
+// Journal file name is defined in main. Data file name is defined inside
 bool saveData(char* argv[])
 {
     char fileName[100];
@@ -641,11 +816,12 @@ bool saveData(char* argv[])
         return false;
     }
 
-    fprintf(fpLog, "Frame size: %d\nAcquired frames: %d ", frameSize, numFrames);
+    _journalSave save = { frameSize, numFrames, 0 };
 
     numFrames = (numFrames > MAX_SAVED_FRAMES) ? MAX_SAVED_FRAMES : numFrames;
 
-    fprintf(fpLog, "Saved frames: %d\n\n", numFrames);
+    save.savedFrames = numFrames;
+    journalWrite(JOURNAL_SAVE, &save, sizeof(save));
 
     fwrite(texoGetCineStart(0), frameSize, numFrames, fpRaw);
 
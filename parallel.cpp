@@ -0,0 +1,233 @@
+/*
+ * @brief     Minimal Win32 worker pool used by the offline processing code
+ *
+ * @details   parallelFor() creates threads for each call, a pool keeps them
+ *            waiting on a semaphore between calls. The threads pick indices
+ *            from a shared counter until all work items are done. This keeps the processing
+ *            modules free of any threading library besides the Windows API,
+ *            which is already required by the acquisition tool.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+
+#include "parallel.h"
+
+// State shared by all workers of one parallelFor() call
+struct _parallelJob
+{
+    PARALLEL_TASK fn;
+    void* prm;
+    int count;
+    volatile LONG next;
+};
+
+static DWORD WINAPI parallelWorker(LPVOID arg)
+{
+    _parallelJob* job = (_parallelJob*)arg;
+    LONG i;
+
+    while ((i = InterlockedIncrement(&job->next) - 1) < job->count)
+    {
+        job->fn(job->prm, (int)i);
+    }
+
+    return 0;
+}
+
+int parallelNumProcessors()
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+}
+
+void parallelFor(int count, PARALLEL_TASK fn, void* prm, int numThreads)
+{
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    _parallelJob job;
+    int i, started = 0;
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (numThreads <= 0)
+    {
+        numThreads = parallelNumProcessors();
+    }
+
+    numThreads = (numThreads > count) ? count : numThreads;
+    numThreads = (numThreads > MAXIMUM_WAIT_OBJECTS) ? MAXIMUM_WAIT_OBJECTS : numThreads;
+
+    job.fn = fn;
+    job.prm = prm;
+    job.count = count;
+    job.next = 0;
+
+    // The calling thread is one of the workers, so all items run even if no
+    // thread could be created
+    for (i = 0; i < numThreads - 1; i++)
+    {
+        threads[started] = CreateThread(NULL, 0, parallelWorker, &job, 0, NULL);
+
+        if (threads[started] != NULL)
+        {
+            started++;
+        }
+    }
+
+    parallelWorker(&job);
+
+    if (started > 0)
+    {
+        WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        CloseHandle(threads[i]);
+    }
+}
+
+// Threads waiting for the next job of a pool
+struct _parallelPool
+{
+    HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+    int numWorkers;
+    // Released once per worker to start a job or to quit
+    HANDLE startSem;
+    // Released by each worker at the end of a job
+    HANDLE doneSem;
+    _parallelJob job;
+    volatile LONG quit;
+};
+
+static DWORD WINAPI parallelPoolWorker(LPVOID arg)
+{
+    _parallelPool* pool = (_parallelPool*)arg;
+
+    for (;;)
+    {
+        WaitForSingleObject(pool->startSem, INFINITE);
+
+        if (pool->quit)
+        {
+            break;
+        }
+
+        parallelWorker(&pool->job);
+        ReleaseSemaphore(pool->doneSem, 1, NULL);
+    }
+
+    return 0;
+}
+
+_parallelPool* parallelPoolCreate(int numThreads)
+{
+    _parallelPool* pool = (_parallelPool*)malloc(sizeof(_parallelPool));
+    int i;
+
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    if (numThreads <= 0)
+    {
+        numThreads = parallelNumProcessors();
+    }
+
+    numThreads = (numThreads > MAXIMUM_WAIT_OBJECTS) ? MAXIMUM_WAIT_OBJECTS : numThreads;
+
+    pool->numWorkers = 0;
+    pool->quit = 0;
+    pool->startSem = CreateSemaphore(NULL, 0, MAXIMUM_WAIT_OBJECTS, NULL);
+    pool->doneSem = CreateSemaphore(NULL, 0, MAXIMUM_WAIT_OBJECTS, NULL);
+
+    if (pool->startSem == NULL || pool->doneSem == NULL)
+    {
+        parallelPoolDestroy(pool);
+        return NULL;
+    }
+
+    // The calling thread is one of the workers
+    for (i = 0; i < numThreads - 1; i++)
+    {
+        pool->threads[pool->numWorkers] = CreateThread(NULL, 0, parallelPoolWorker, pool, 0, NULL);
+
+        if (pool->threads[pool->numWorkers] != NULL)
+        {
+            pool->numWorkers++;
+        }
+    }
+
+    return pool;
+}
+
+bool parallelPoolRun(_parallelPool* pool, int count, PARALLEL_TASK fn, void* prm)
+{
+    int i;
+
+    if (count <= 0)
+    {
+        return true;
+    }
+
+    pool->job.fn = fn;
+    pool->job.prm = prm;
+    pool->job.count = count;
+    pool->job.next = 0;
+
+    if (pool->numWorkers > 0)
+    {
+        ReleaseSemaphore(pool->startSem, pool->numWorkers, NULL);
+    }
+
+    parallelWorker(&pool->job);
+
+    for (i = 0; i < pool->numWorkers; i++)
+    {
+        WaitForSingleObject(pool->doneSem, INFINITE);
+    }
+
+    return true;
+}
+
+void parallelPoolDestroy(_parallelPool* pool)
+{
+    int i;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    pool->quit = 1;
+
+    if (pool->numWorkers > 0)
+    {
+        ReleaseSemaphore(pool->startSem, pool->numWorkers, NULL);
+        WaitForMultipleObjects(pool->numWorkers, pool->threads, TRUE, INFINITE);
+    }
+
+    for (i = 0; i < pool->numWorkers; i++)
+    {
+        CloseHandle(pool->threads[i]);
+    }
+
+    if (pool->startSem != NULL)
+    {
+        CloseHandle(pool->startSem);
+    }
+
+    if (pool->doneSem != NULL)
+    {
+        CloseHandle(pool->doneSem);
+    }
+
+    free(pool);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+/// Work item executed by parallelFor() once for each index.
+////////////////////////////////////////////////////////////////////////////////
+typedef void (*PARALLEL_TASK)(void* prm, int index);
+
+/// Number of logical processors of the machine
+int parallelNumProcessors();
+
+/// Run fn(prm, i) for every i in [0, count) over a set of worker threads.
+/// Indices are handed out dynamically, so uneven work items are balanced.
+/// numThreads = 0 uses one thread per processor. Returns after all items ran,
+/// on the calling thread alone if no other thread could be created
+void parallelFor(int count, PARALLEL_TASK fn, void* prm, int numThreads = 0);
+
+////////////////////////////////////////////////////////////////////////////////
+/// Worker threads kept alive between parallelPoolRun() calls, for loops that
+/// run many parallel steps one after the other.
+////////////////////////////////////////////////////////////////////////////////
+struct _parallelPool;
+
+/// Start a pool of numThreads workers, the calling thread being one of them.
+/// numThreads = 0 uses one thread per processor. Returns NULL on error
+_parallelPool* parallelPoolCreate(int numThreads = 0);
+
+/// Same as parallelFor() on the threads of the pool
+bool parallelPoolRun(_parallelPool* pool, int count, PARALLEL_TASK fn, void* prm);
+
+/// Stop the threads of the pool and free it
+void parallelPoolDestroy(_parallelPool* pool);
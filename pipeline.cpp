@@ -0,0 +1,323 @@
+/*
+ * @brief     Out-of-core processing of datasets larger than the memory
+ *
+ * @details   The scanline files are split in tiles of whole frames, which are
+ *            contiguous in the file and can be read with one sequential read.
+ *            A fixed pool of tile buffers is allocated once from the memory
+ *            budget and used in round robin: a loader thread fills the next
+ *            free buffer while the processing threads work on the current one
+ *            and the results are appended to the output file. The processing
+ *            threads are a pool created once per run, not once per tile. Memory use does
+ *            not depend on the size of the dataset, and with enough buffers
+ *            the throughput is bounded by the disk.
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipeline.h"
+#include "processing.h"
+#include "parallel.h"
+
+/// Maximum number of tile buffers in the pool
+#define PIPELINE_MAX_BUFFERS 16
+
+// One entry of the buffer pool and the tile it currently holds
+struct _pipelineTile
+{
+    short* data;
+    int scanline;
+    int firstFrame;
+    // 0 marks the end of the dataset
+    int numFrames;
+    bool ok;
+};
+
+// State shared by the loader thread and the processing side
+struct _pipelineState
+{
+    const _pipelineConfig* cfg;
+    _pipelineTile tiles[PIPELINE_MAX_BUFFERS];
+    int numBuffers;
+    int tileFrames;
+    // Frames of every scanline file
+    int numFrames;
+    // Counts free buffers and buffers ready to be processed
+    HANDLE freeSem;
+    HANDLE readySem;
+    volatile LONG cancel;
+};
+
+// Arguments of the per-frame work item
+struct _pipelineJob
+{
+    const _procParams* prm;
+    const short* data;
+    float* results;
+    float* work;
+    size_t frameSamples;
+};
+
+static DWORD WINAPI pipelineLoader(LPVOID arg)
+{
+    _pipelineState* st = (_pipelineState*)arg;
+    const _pipelineConfig& cfg = *st->cfg;
+    char fileName[RAW_MAX_PATH];
+    int scanline, frame, count, slot = 0;
+    int numFrames = st->numFrames;
+    bool ok = true;
+    FILE* fpRaw;
+    _pipelineTile* tile;
+
+    for (scanline = 0; ok && scanline < cfg.numOfScanlines; scanline++)
+    {
+        rawFileName(cfg.prefix, scanline, fileName, sizeof(fileName));
+
+        fpRaw = fopen(fileName, "rb");
+        ok = (fpRaw != NULL);
+
+        for (frame = 0; ok && frame < numFrames; frame += count)
+        {
+            count = (numFrames - frame < st->tileFrames) ? numFrames - frame : st->tileFrames;
+
+            WaitForSingleObject(st->freeSem, INFINITE);
+
+            if (st->cancel)
+            {
+                ok = false;
+                break;
+            }
+
+            tile = &st->tiles[slot];
+            tile->scanline = scanline;
+            tile->firstFrame = frame;
+            tile->numFrames = count;
+            tile->ok = ok = rawReadFrames(fpRaw, cfg.layout, frame, count, tile->data);
+
+            ReleaseSemaphore(st->readySem, 1, NULL);
+            slot = (slot + 1) % st->numBuffers;
+        }
+
+        if (fpRaw != NULL)
+        {
+            fclose(fpRaw);
+        }
+    }
+
+    // End of the dataset, or error opening a file
+    WaitForSingleObject(st->freeSem, INFINITE);
+    st->tiles[slot].numFrames = 0;
+    st->tiles[slot].ok = ok;
+    ReleaseSemaphore(st->readySem, 1, NULL);
+
+    return 0;
+}
+
+static void processFrame(void* prm, int index)
+{
+    _pipelineJob* job = (_pipelineJob*)prm;
+
+    procFrame(*job->prm, job->data + index * job->frameSamples, job->work + index * (size_t)job->prm->numSamples,
+              job->results + index * (size_t)job->prm->numSamples);
+}
+
+bool pipelineRun(const _pipelineConfig& cfg)
+{
+    _pipelineState st;
+    _pipelineJob job;
+    _procParams prm;
+    _pipelineTile* tile;
+    _parallelPool* pool = NULL;
+    HANDLE loader = NULL;
+    FILE* fpOut;
+    float* results = NULL;
+    float* work = NULL;
+    size_t frameBytes, resultBytes, framesRead = 0;
+    char fileName[RAW_MAX_PATH];
+    int i, slot = 0, numFrames;
+    bool ok = true;
+    LARGE_INTEGER start, end, freq;
+
+    frameBytes = (size_t)cfg.layout.channels * cfg.layout.numSamples * sizeof(short);
+    resultBytes = (size_t)cfg.layout.numSamples * sizeof(float);
+
+    if (cfg.numBuffers < 2 || cfg.numBuffers > PIPELINE_MAX_BUFFERS)
+    {
+        printf("ERROR: The tile pool must have 2 to %d buffers\n", PIPELINE_MAX_BUFFERS);
+        return false;
+    }
+
+    // The output has no index, so scanline s starts at s * numFrames frames
+    // only if every file has the same number of frames
+    st.numFrames = -1;
+    for (i = 0; i < cfg.numOfScanlines; i++)
+    {
+        rawFileName(cfg.prefix, i, fileName, sizeof(fileName));
+        numFrames = rawGetNumFrames(fileName, cfg.layout);
+
+        if (numFrames < 0)
+        {
+            return false;
+        }
+
+        if (st.numFrames >= 0 && numFrames != st.numFrames)
+        {
+            printf("ERROR: %s has %d frames, the previous scanline files have %d\n", fileName, numFrames,
+                   st.numFrames);
+            return false;
+        }
+
+        st.numFrames = numFrames;
+    }
+
+    // Each frame of a tile takes one slot in every buffer, one result line
+    // and one work line
+    st.cfg = &cfg;
+    st.numBuffers = cfg.numBuffers;
+    st.tileFrames = (int)(cfg.memoryBudget / (cfg.numBuffers * frameBytes + 2 * resultBytes));
+    st.cancel = 0;
+    st.freeSem = NULL;
+    st.readySem = NULL;
+
+    if (st.tileFrames < 1)
+    {
+        printf("ERROR: Memory budget of %.0f bytes is too small for %d frames of %.0f bytes\n",
+               (double)cfg.memoryBudget, cfg.numBuffers, (double)frameBytes);
+        return false;
+    }
+
+    // A tile never spans files, so larger tiles would only waste the budget
+    if (st.tileFrames > st.numFrames)
+    {
+        st.tileFrames = (st.numFrames > 0) ? st.numFrames : 1;
+    }
+
+    if (!procInit(prm, cfg.layout.channels, cfg.layout.numSamples, cfg.layout.samplingFreq, cfg.centerFreq,
+                  2e-6 * cfg.layout.saveDelay / cfg.layout.speedOfSound, cfg.filterOrder))
+    {
+        return false;
+    }
+
+    for (i = 0; i < st.numBuffers; i++)
+    {
+        st.tiles[i].data = (short*)malloc(st.tileFrames * frameBytes);
+        ok = ok && (st.tiles[i].data != NULL);
+    }
+
+    results = (float*)malloc(st.tileFrames * resultBytes);
+    work = (float*)malloc(st.tileFrames * resultBytes);
+    fpOut = fopen(cfg.outFileName, "wb");
+
+    if (!ok || results == NULL || work == NULL || fpOut == NULL)
+    {
+        printf("ERROR: Could not allocate the tile buffers or create %s\n", cfg.outFileName);
+        ok = false;
+        goto cleanup;
+    }
+
+    printf("Processing in tiles of %d frames with %d buffers, %s kernels\n", st.tileFrames, st.numBuffers,
+           kernelIsaName(prm.kernels.isa));
+
+    // No tight maximum count: cancelling releases more than the pool size
+    st.freeSem = CreateSemaphore(NULL, st.numBuffers, 0x7FFFFFFF, NULL);
+    st.readySem = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    pool = parallelPoolCreate(cfg.numThreads);
+
+    if (st.freeSem == NULL || st.readySem == NULL || pool == NULL)
+    {
+        printf("ERROR: Could not create the processing threads\n");
+        ok = false;
+        goto cleanup;
+    }
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    loader = CreateThread(NULL, 0, pipelineLoader, &st, 0, NULL);
+
+    // Without the loader nothing would ever release readySem
+    if (loader == NULL)
+    {
+        printf("ERROR: Could not start the loader thread\n");
+        ok = false;
+        goto cleanup;
+    }
+
+    for (;;)
+    {
+        WaitForSingleObject(st.readySem, INFINITE);
+        tile = &st.tiles[slot];
+
+        if (!tile->ok || tile->numFrames == 0)
+        {
+            ok = tile->ok;
+            break;
+        }
+
+        job.prm = &prm;
+        job.data = tile->data;
+        job.results = results;
+        job.work = work;
+        job.frameSamples = (size_t)cfg.layout.channels * cfg.layout.numSamples;
+
+        parallelPoolRun(pool, tile->numFrames, processFrame, &job);
+
+        // The raw data is no longer needed, let the loader refill the buffer
+        framesRead += tile->numFrames;
+        i = tile->numFrames;
+        ReleaseSemaphore(st.freeSem, 1, NULL);
+        slot = (slot + 1) % st.numBuffers;
+
+        if (fwrite(results, resultBytes, i, fpOut) != (size_t)i)
+        {
+            printf("ERROR: Could not write to %s\n", cfg.outFileName);
+            ok = false;
+            break;
+        }
+    }
+
+    // Unblock the loader if processing stopped early
+    st.cancel = 1;
+    ReleaseSemaphore(st.freeSem, st.numBuffers, NULL);
+    WaitForSingleObject(loader, INFINITE);
+    CloseHandle(loader);
+
+    QueryPerformanceCounter(&end);
+
+    if (ok)
+    {
+        double seconds = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+        printf("Processed %.0f frames in %.2f s (%.1f MB/s)\n", (double)framesRead, seconds,
+               framesRead * frameBytes / (seconds * 1048576.0));
+    }
+
+cleanup:
+    parallelPoolDestroy(pool);
+
+    if (st.freeSem != NULL)
+    {
+        CloseHandle(st.freeSem);
+    }
+
+    if (st.readySem != NULL)
+    {
+        CloseHandle(st.readySem);
+    }
+
+    if (fpOut != NULL)
+    {
+        fclose(fpOut);
+    }
+
+    for (i = 0; i < st.numBuffers; i++)
+    {
+        free(st.tiles[i].data);
+    }
+
+    free(results);
+    free(work);
+    procFree(prm);
+
+    return ok;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "raw_reader.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// Configuration of the streaming B mode processing of a dataset.
+////////////////////////////////////////////////////////////////////////////////
+struct _pipelineConfig
+{
+    /// file name prefix, e.g. probeId_2_singleRx. "_scanline_<n>.raw" is appended
+    const char* prefix;
+    /// number of scanline files of the dataset
+    int numOfScanlines;
+    /// layout of the scanline files
+    _rawLayout layout;
+    /// demodulation frequency in Hz
+    double centerFreq;
+    /// order of the demodulation low pass filter (2 in load_texo_raw.m)
+    int filterOrder;
+    /// maximum memory in bytes used by the tile buffers and the results
+    size_t memoryBudget;
+    /// number of tile buffers in the pool, at least 2 so one can be loaded
+    /// while another one is processed
+    int numBuffers;
+    /// number of processing threads, 0 for one per processor
+    int numThreads;
+    /// envelope output, floats stored as [scanline][frame][sample]. Every
+    /// scanline file must have the same number of frames
+    const char* outFileName;
+};
+
+/// Process every frame of every scanline file (load, channel sum, IQ
+/// demodulation, envelope) in tiles of whole frames. The next tile is read by a
+/// background thread while the current one is processed, so the dataset may be
+/// much larger than the memory budget
+bool pipelineRun(const _pipelineConfig& cfg);
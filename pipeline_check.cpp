@@ -0,0 +1,176 @@
+/*
+ * @brief     Check of the out-of-core pipeline against procFrame()
+ *
+ * @details   Writes scanline files of random samples and runs pipelineRun()
+ *            with memory budgets that give tiles of one frame, of a few
+ *            frames that do not divide the files, and of whole files. The
+ *            output must match procFrame() on every frame bit for bit. Then
+ *            one file is cut short, which pipelineRun() must reject.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "processing.h"
+#include "raw_reader.h"
+
+/// Size of the simulated dataset
+#define NUM_SCANLINES 5
+#define NUM_FRAMES 11
+#define CHANNELS 64
+#define NUM_SAMPLES 2000
+
+/// Frames per tile of each run, the budget is computed from them
+#define NUM_TILE_SIZES 3
+static const int tileSizes[NUM_TILE_SIZES] = { 1, 4, NUM_FRAMES };
+
+static bool writeDataset(const char* prefix, short* frames)
+{
+    size_t frameSamples = (size_t)CHANNELS * NUM_SAMPLES;
+    char fileName[RAW_MAX_PATH];
+    size_t i;
+    int s;
+    FILE* fp;
+
+    srand(1);
+
+    for (s = 0; s < NUM_SCANLINES; s++)
+    {
+        short* data = frames + (size_t)s * NUM_FRAMES * frameSamples;
+
+        for (i = 0; i < NUM_FRAMES * frameSamples; i++)
+        {
+            data[i] = (short)(rand() % 4096 - 2048);
+        }
+
+        rawFileName(prefix, s, fileName, sizeof(fileName));
+        fp = fopen(fileName, "wb");
+        if (!fp || fwrite(data, sizeof(short), NUM_FRAMES * frameSamples, fp) != NUM_FRAMES * frameSamples)
+        {
+            printf("ERROR: Could not write file %s\n", fileName);
+            if (fp)
+            {
+                fclose(fp);
+            }
+            return false;
+        }
+        fclose(fp);
+    }
+
+    return true;
+}
+
+// Compare the output file with the expected envelopes
+static bool compareOutput(const char* fileName, const float* expected)
+{
+    size_t count = (size_t)NUM_SCANLINES * NUM_FRAMES * NUM_SAMPLES;
+    float* output = (float*)malloc(sizeof(float) * (count + 1));
+    FILE* fp = fopen(fileName, "rb");
+    bool ok = (output != NULL && fp != NULL);
+
+    // Exactly count values, nothing after them
+    ok = ok && (fread(output, sizeof(float), count + 1, fp) == count) &&
+         (memcmp(output, expected, sizeof(float) * count) == 0);
+
+    if (fp)
+    {
+        fclose(fp);
+    }
+    free(output);
+
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* prefix = (argc > 1) ? argv[1] : "pipeline_check";
+    size_t frameSamples = (size_t)CHANNELS * NUM_SAMPLES;
+    size_t frameBytes = frameSamples * sizeof(short);
+    size_t resultBytes = NUM_SAMPLES * sizeof(float);
+    _pipelineConfig cfg;
+    _procParams prm;
+    char fileName[RAW_MAX_PATH], outFileName[RAW_MAX_PATH];
+    short* frames = (short*)malloc(frameBytes * NUM_SCANLINES * NUM_FRAMES);
+    float* expected = (float*)malloc(resultBytes * NUM_SCANLINES * NUM_FRAMES);
+    float* rf = (float*)malloc(resultBytes);
+    int i, t;
+    bool ok, same;
+    FILE* fp;
+
+    cfg.prefix = prefix;
+    cfg.numOfScanlines = NUM_SCANLINES;
+    cfg.layout.channels = CHANNELS;
+    cfg.layout.numSamples = NUM_SAMPLES;
+    cfg.layout.samplingFreq = 40000000;
+    cfg.layout.speedOfSound = 1540;
+    cfg.layout.saveDelay = 5000;
+    cfg.centerFreq = 9.5e6;
+    cfg.filterOrder = 2;
+    cfg.numBuffers = 3;
+    cfg.numThreads = 0;
+    cfg.outFileName = outFileName;
+
+    sprintf(outFileName, "%.500s_envelope.bin", prefix);
+
+    if (frames == NULL || expected == NULL || rf == NULL)
+    {
+        printf("ERROR: Not enough memory\n");
+        return -1;
+    }
+
+    ok = writeDataset(prefix, frames) &&
+         procInit(prm, CHANNELS, NUM_SAMPLES, cfg.layout.samplingFreq, cfg.centerFreq,
+                  2e-6 * cfg.layout.saveDelay / cfg.layout.speedOfSound, cfg.filterOrder);
+
+    if (ok)
+    {
+        for (i = 0; i < NUM_SCANLINES * NUM_FRAMES; i++)
+        {
+            procFrame(prm, frames + i * frameSamples, rf, expected + (size_t)i * NUM_SAMPLES);
+        }
+        procFree(prm);
+    }
+
+    for (t = 0; ok && t < NUM_TILE_SIZES; t++)
+    {
+        // Budget of exactly tileSizes[t] frames (see pipelineRun())
+        cfg.memoryBudget = tileSizes[t] * (cfg.numBuffers * frameBytes + 2 * resultBytes);
+
+        same = pipelineRun(cfg) && compareOutput(outFileName, expected);
+        printf("Tiles of %d frames: %s\n", tileSizes[t], same ? "identical" : "DIFFERS");
+        ok = same;
+    }
+
+    // A file with fewer frames than the others cannot be indexed in the output
+    if (ok)
+    {
+        rawFileName(prefix, 2, fileName, sizeof(fileName));
+        fp = fopen(fileName, "wb");
+        ok = (fp != NULL) && (fwrite(frames, frameBytes, 1, fp) == 1);
+        if (fp)
+        {
+            fclose(fp);
+        }
+
+        same = ok && !pipelineRun(cfg);
+        printf("Scanline file with fewer frames: %s\n", same ? "rejected" : "ACCEPTED");
+        ok = same;
+    }
+
+    for (i = 0; i < NUM_SCANLINES; i++)
+    {
+        rawFileName(prefix, i, fileName, sizeof(fileName));
+        remove(fileName);
+    }
+    remove(outFileName);
+
+    free(frames);
+    free(expected);
+    free(rf);
+
+    printf("%s\n", ok ? "Pipeline check passed" : "Pipeline check FAILED");
+
+    return ok ? 0 : -1;
+}
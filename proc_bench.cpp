@@ -0,0 +1,59 @@
+/*
+ * @brief     Check and time the processing kernels on this processor
+ *
+ * @details   Runs procBenchmark() for one channel count and filter length
+ *            given on the command line, or for every specialized combination
+ *            (32 and 64 channels, 3, 5 and 9 taps) without arguments. The
+ *            exit code is 0 only if every kernel was bit-exact.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "processing.h"
+
+int main(int argc, char* argv[])
+{
+    const int channels[] = { 32, 64 };
+    const int taps[] = { 3, 5, 9 };
+    int numSamples = 2048, failed = 0, c, t;
+
+    if (argc != 1 && argc != 4)
+    {
+        fprintf(stderr, "Usage: %s [channels] [samples] [taps]\n\n", argv[0]);
+        fprintf(stderr, "Example: %s 64 2000 3\n", argv[0]);
+
+        return -1;
+    }
+
+    printf("Kernels up to %s on this processor\n\n", kernelIsaName(kernelDetectIsa()));
+
+    if (argc == 4)
+    {
+        numSamples = atoi(argv[2]);
+
+        if (atoi(argv[1]) < 1 || numSamples < 1 || atoi(argv[3]) < 1)
+        {
+            fprintf(stderr, "ERROR: Invalid channels, samples or taps\n");
+            return -1;
+        }
+
+        return procBenchmark(atoi(argv[1]), numSamples, atoi(argv[3])) ? 0 : -1;
+    }
+
+    for (c = 0; c < 2; c++)
+    {
+        for (t = 0; t < 3; t++)
+        {
+            if (!procBenchmark(channels[c], numSamples, taps[t]))
+            {
+                failed++;
+            }
+            printf("\n");
+        }
+    }
+
+    printf("%d of 6 kernel sets failed\n", failed);
+
+    return (failed == 0) ? 0 : -1;
+}
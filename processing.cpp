@@ -0,0 +1,354 @@
+/*
+ * @brief     B mode processing of the lines acquired by the singleRx and
+ *            phasedArray modes
+ *
+ * @details   This is the C++ version of the processing in load_texo_raw.m:
+ *            the lines of all channels are summed, mixed down with cos and sin
+ *            of the center frequency, filtered by filter(b, 1, x) with
+ *            b = fir1(2, fc/2/fNyq) and the envelope is sqrt(I^2 + Q^2).
+ *
+ * @sa        http://www.ultrasonix.com/wikisonix/index.php?title=IQ_Demodulation
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "processing.h"
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846
+#endif
+
+void procFir1Lowpass(int order, double wn, double* taps)
+{
+    int n;
+    double x, sum = 0.0;
+
+    for (n = 0; n <= order; n++)
+    {
+        // Ideal low pass centered in the filter, Hamming window
+        x = n - order / 2.0;
+        taps[n] = (x == 0.0) ? wn : sin(M_PI * wn * x) / (M_PI * x);
+        taps[n] *= (order > 0) ? 0.54 - 0.46 * cos(2.0 * M_PI * n / order) : 1.0;
+        sum += taps[n];
+    }
+
+    // Unit gain at DC
+    for (n = 0; n <= order; n++)
+    {
+        taps[n] /= sum;
+    }
+}
+
+bool procInit(_procParams& prm, int channels, int numSamples, int samplingFreq,
+              double centerFreq, double startTime, int filterOrder)
+{
+    int n;
+    double phase;
+
+    if (filterOrder < 0 || filterOrder >= PROC_MAX_TAPS)
+    {
+        printf("ERROR: Invalid filter order %d\n", filterOrder);
+        return false;
+    }
+
+    prm.channels = channels;
+    prm.numSamples = numSamples;
+    prm.numTaps = filterOrder + 1;
+    procFir1Lowpass(filterOrder, centerFreq / samplingFreq, prm.taps);
+    kernelSelect(channels, prm.numTaps, kernelDetectIsa(), prm.kernels);
+
+    prm.cosTable = (float*)malloc(sizeof(float) * numSamples);
+    prm.sinTable = (float*)malloc(sizeof(float) * numSamples);
+
+    if (prm.cosTable == NULL || prm.sinTable == NULL)
+    {
+        printf("ERROR: Not enough memory for the mixing tables\n");
+        procFree(prm);
+        return false;
+    }
+
+    for (n = 0; n < numSamples; n++)
+    {
+        phase = 2.0 * M_PI * centerFreq * (startTime + (double)n / samplingFreq);
+        prm.cosTable[n] = (float)cos(phase);
+        prm.sinTable[n] = (float)sin(phase);
+    }
+
+    return true;
+}
+
+void procFree(_procParams& prm)
+{
+    free(prm.cosTable);
+    free(prm.sinTable);
+    prm.cosTable = prm.sinTable = NULL;
+}
+
+void procChannelSum(const _procParams& prm, const short* frame, float* rf)
+{
+    int c, n;
+    const short* line;
+
+    for (n = 0; n < prm.numSamples; n++)
+    {
+        rf[n] = frame[n];
+    }
+
+    for (c = 1; c < prm.channels; c++)
+    {
+        line = frame + (size_t)c * prm.numSamples;
+
+        for (n = 0; n < prm.numSamples; n++)
+        {
+            rf[n] += line[n];
+        }
+    }
+}
+
+void procEnvelope(const _procParams& prm, const float* rf, float* env)
+{
+    // Last inputs of the filters, i[k] is the input k samples ago
+    double i[PROC_MAX_TAPS] = { 0 }, q[PROC_MAX_TAPS] = { 0 };
+    double fi, fq;
+    int n, k;
+
+    for (n = 0; n < prm.numSamples; n++)
+    {
+        for (k = prm.numTaps - 1; k > 0; k--)
+        {
+            i[k] = i[k - 1];
+            q[k] = q[k - 1];
+        }
+
+        i[0] = rf[n] * prm.cosTable[n];
+        q[0] = -rf[n] * prm.sinTable[n];
+
+        fi = fq = 0.0;
+        for (k = 0; k < prm.numTaps; k++)
+        {
+            fi += prm.taps[k] * i[k];
+            fq += prm.taps[k] * q[k];
+        }
+
+        env[n] = (float)sqrt(fi * fi + fq * fq);
+    }
+}
+
+void procDemodulate(const _procParams& prm, const float* rf, double* iq)
+{
+    int n, k;
+    double fi, fq;
+
+    // Direct form of filter(b, 1, x), the input before the line is zero
+    for (n = 0; n < prm.numSamples; n++)
+    {
+        fi = fq = 0.0;
+        for (k = 0; k < prm.numTaps && k <= n; k++)
+        {
+            fi += prm.taps[k] * (rf[n - k] * prm.cosTable[n - k]);
+            fq += prm.taps[k] * (-rf[n - k] * prm.sinTable[n - k]);
+        }
+
+        iq[2 * n] = fi;
+        iq[2 * n + 1] = fq;
+    }
+}
+
+void procMagnitude(const _procParams& prm, const double* iq, float* env)
+{
+    int n;
+
+    // In double as procEnvelope(), so both give the same envelope
+    for (n = 0; n < prm.numSamples; n++)
+    {
+        env[n] = (float)sqrt(iq[2 * n] * iq[2 * n] + iq[2 * n + 1] * iq[2 * n + 1]);
+    }
+}
+
+void procLogCompress(const float* env, int count, double dBRange, double reject, float* image)
+{
+    int n;
+    double b;
+
+    for (n = 0; n < count; n++)
+    {
+        b = 255.0 * (20.0 * log10((double)env[n]) - reject) / dBRange;
+        // log10(0) gives -inf, which is clipped to black as well
+        image[n] = (float)((b > 255.0) ? 255.0 : (b > 0.0) ? b : 0.0);
+    }
+}
+
+void procFrame(const _procParams& prm, const short* frame, float* rf, float* env)
+{
+    if (prm.kernels.channelSum != NULL)
+    {
+        prm.kernels.channelSum(frame, prm.numSamples, rf);
+    }
+    else
+    {
+        procChannelSum(prm, frame, rf);
+    }
+
+    if (prm.kernels.envelope != NULL)
+    {
+        prm.kernels.envelope(prm.taps, prm.cosTable, prm.sinTable, prm.numSamples, rf, env);
+    }
+    else
+    {
+        procEnvelope(prm, rf, env);
+    }
+}
+
+// Seconds per call of a kernel, averaged over the runs timed together
+static double timeRuns(LARGE_INTEGER* start, LARGE_INTEGER* end, int runs)
+{
+    LARGE_INTEGER freq;
+
+    QueryPerformanceFrequency(&freq);
+
+    return (double)(end->QuadPart - start->QuadPart) / freq.QuadPart / runs;
+}
+
+bool procBenchmark(int channels, int numSamples, int numTaps)
+{
+    const int runs = 200;
+    _procParams prm;
+    _kernelSet set;
+    short* frame = (short*)malloc(sizeof(short) * channels * numSamples);
+    float* refRf = (float*)malloc(sizeof(float) * numSamples);
+    float* refEnv = (float*)malloc(sizeof(float) * numSamples);
+    float* refAcc = (float*)malloc(sizeof(float) * numSamples);
+    float* rf = (float*)malloc(sizeof(float) * numSamples);
+    float* env = (float*)malloc(sizeof(float) * numSamples);
+    float* acc = (float*)malloc(sizeof(float) * numSamples);
+    float* tofTx = (float*)malloc(sizeof(float) * numSamples);
+    float* tofRx = (float*)malloc(sizeof(float) * numSamples);
+    double refTime[3], isaTime[3];
+    bool exact = true, compared = false, same[3];
+    int isa, i, r;
+    LARGE_INTEGER start, end;
+
+    // procFree() is safe on tables procInit() did not allocate
+    prm.cosTable = prm.sinTable = NULL;
+
+    if (!frame || !refRf || !refEnv || !refAcc || !rf || !env || !acc || !tofTx || !tofRx ||
+        !procInit(prm, channels, numSamples, 40000000, 5e6, 0.0, numTaps - 1))
+    {
+        printf("ERROR: Not enough memory for the benchmark\n");
+        exact = false;
+        goto cleanup;
+    }
+
+    srand(1);
+    for (i = 0; i < channels * numSamples; i++)
+    {
+        frame[i] = (short)(rand() % 65536 - 32768);
+    }
+
+    // Times of flight over the whole line and a bit out of it on both ends
+    for (i = 0; i < numSamples; i++)
+    {
+        tofTx[i] = (float)rand() / RAND_MAX * (numSamples / 2 + 8) - 8;
+        tofRx[i] = (float)rand() / RAND_MAX * (numSamples / 2 + 8) - 8;
+    }
+
+    QueryPerformanceCounter(&start);
+    for (r = 0; r < runs; r++)
+    {
+        procChannelSum(prm, frame, refRf);
+    }
+    QueryPerformanceCounter(&end);
+    refTime[0] = timeRuns(&start, &end, runs);
+
+    QueryPerformanceCounter(&start);
+    for (r = 0; r < runs; r++)
+    {
+        procEnvelope(prm, refRf, refEnv);
+    }
+    QueryPerformanceCounter(&end);
+    refTime[1] = timeRuns(&start, &end, runs);
+
+    memset(refAcc, 0, sizeof(float) * numSamples);
+    QueryPerformanceCounter(&start);
+    for (r = 0; r < runs; r++)
+    {
+        kernelInterpolateReference(frame, numSamples, tofTx, tofRx, refAcc, numSamples);
+    }
+    QueryPerformanceCounter(&end);
+    refTime[2] = timeRuns(&start, &end, runs);
+
+    printf("Kernels for %d channels, %d samples, %d taps (reference: %.1f, %.1f, %.1f us)\n",
+           channels, numSamples, numTaps, 1e6 * refTime[0], 1e6 * refTime[1], 1e6 * refTime[2]);
+
+    for (isa = KERNEL_SCALAR; isa <= kernelDetectIsa(); isa++)
+    {
+        kernelSelect(channels, numTaps, (_kernelIsa)isa, set);
+
+        if (set.channelSum == NULL || set.envelope == NULL)
+        {
+            break;
+        }
+
+        QueryPerformanceCounter(&start);
+        for (r = 0; r < runs; r++)
+        {
+            set.channelSum(frame, numSamples, rf);
+        }
+        QueryPerformanceCounter(&end);
+        isaTime[0] = timeRuns(&start, &end, runs);
+
+        QueryPerformanceCounter(&start);
+        for (r = 0; r < runs; r++)
+        {
+            set.envelope(prm.taps, prm.cosTable, prm.sinTable, numSamples, refRf, env);
+        }
+        QueryPerformanceCounter(&end);
+        isaTime[1] = timeRuns(&start, &end, runs);
+
+        memset(acc, 0, sizeof(float) * numSamples);
+        QueryPerformanceCounter(&start);
+        for (r = 0; r < runs; r++)
+        {
+            set.interpolate(frame, numSamples, tofTx, tofRx, acc, numSamples);
+        }
+        QueryPerformanceCounter(&end);
+        isaTime[2] = timeRuns(&start, &end, runs);
+
+        same[0] = memcmp(rf, refRf, sizeof(float) * numSamples) == 0;
+        same[1] = memcmp(env, refEnv, sizeof(float) * numSamples) == 0;
+        same[2] = memcmp(acc, refAcc, sizeof(float) * numSamples) == 0;
+        exact = exact && same[0] && same[1] && same[2];
+        compared = true;
+
+        printf("%-8s channel sum %5.1fx %s, envelope %5.1fx %s, interpolation %5.1fx %s\n",
+               kernelIsaName((_kernelIsa)isa),
+               refTime[0] / isaTime[0], same[0] ? "exact" : "DIFFERS",
+               refTime[1] / isaTime[1], same[1] ? "exact" : "DIFFERS",
+               refTime[2] / isaTime[2], same[2] ? "exact" : "DIFFERS");
+    }
+
+    // Nothing was checked, which must not pass for a success
+    if (!compared)
+    {
+        printf("ERROR: No kernels specialized for %d channels and %d taps\n", channels, numTaps);
+        exact = false;
+    }
+
+cleanup:
+    procFree(prm);
+    free(frame);
+    free(refRf);
+    free(refEnv);
+    free(refAcc);
+    free(rf);
+    free(env);
+    free(acc);
+    free(tofTx);
+    free(tofRx);
+
+    return exact;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "kernels.h"
+
+/// Maximum number of taps of the demodulation low pass filter
+#define PROC_MAX_TAPS 64
+
+////////////////////////////////////////////////////////////////////////////////
+/// Parameters of the B mode processing of one line, as in load_texo_raw.m:
+/// channel sum, IQ demodulation with a FIR low pass filter and envelope.
+////////////////////////////////////////////////////////////////////////////////
+struct _procParams
+{
+    /// number of channels summed to form the line
+    int channels;
+    /// number of samples of each channel
+    int numSamples;
+    /// number of taps of the low pass filter
+    int numTaps;
+    /// low pass filter coefficients, same as fir1(numTaps - 1, fc / fs)
+    double taps[PROC_MAX_TAPS];
+    /// mixing tables, cos and sin of 2*pi*fc*t for each sample
+    float* cosTable;
+    float* sinTable;
+    /// kernels specialized for channels and numTaps (see kernels.h)
+    _kernelSet kernels;
+};
+
+/// Coefficients of a Hamming windowed low pass FIR filter, same as MATLAB's
+/// fir1(order, wn), where wn is the cutoff normalized to the Nyquist frequency
+void procFir1Lowpass(int order, double wn, double* taps);
+
+/// Fill the filter and the mixing tables. startTime is the two-way time in
+/// seconds of the first sample (2 * saveDelay / speedOfSound)
+bool procInit(_procParams& prm, int channels, int numSamples, int samplingFreq,
+              double centerFreq, double startTime, int filterOrder = 2);
+
+/// Release the mixing tables
+void procFree(_procParams& prm);
+
+/// Sum the lines of all channels of one frame (receive beamforming is done by
+/// the hardware, each channel was acquired with the same focusing). Scalar
+/// reference of the channel sum kernels
+void procChannelSum(const _procParams& prm, const short* frame, float* rf);
+
+/// Demodulate, low pass filter and take the magnitude of a line. env may be
+/// the same buffer as rf. Scalar reference of the envelope kernels
+void procEnvelope(const _procParams& prm, const float* rf, float* env);
+
+/// Demodulate and low pass filter a line. iq holds I and Q interleaved,
+/// 2 * numSamples values, in double precision as inside procEnvelope()
+void procDemodulate(const _procParams& prm, const float* rf, double* iq);
+
+/// Magnitude of an interleaved IQ line. procDemodulate() followed by
+/// procMagnitude() gives exactly the result of procEnvelope()
+void procMagnitude(const _procParams& prm, const double* iq, float* env);
+
+/// Log compression for display as in load_texo_raw.m: gray levels from 0 to
+/// 255 for envelopes from reject to reject + dBRange dB
+void procLogCompress(const float* env, int count, double dBRange, double reject, float* image);
+
+/// procChannelSum() followed by procEnvelope(), with the specialized kernels
+/// when there are. rf is a work buffer of numSamples values
+void procFrame(const _procParams& prm, const short* frame, float* rf, float* env);
+
+/// Check that the kernels of every instruction set supported by the processor
+/// give bit-exact the results of the scalar references on random data, and
+/// print the time of each one and its speedup over the reference. Returns
+/// false when a kernel differs or there are no kernels for channels and numTaps
+bool procBenchmark(int channels, int numSamples, int numTaps);
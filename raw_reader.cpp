@@ -0,0 +1,181 @@
+/*
+ * @brief     Partial reads of the scanline files written by the acquisition
+ *
+ * @details   The files have no header, so the position of any sample follows
+ *            from the layout: frame, then channel, then sample. Reading a depth
+ *            window or a subset of channels seeks straight to each requested
+ *            line segment instead of loading the whole file.
+ */
+
+#include <stdio.h>
+
+#include "raw_reader.h"
+
+/// Sampling frequency of the receive hardware without decimation
+#define RAW_BASE_SAMPLING_FREQ 40000000
+
+int rawSamplingFreq(int decimation)
+{
+    return RAW_BASE_SAMPLING_FREQ >> decimation;
+}
+
+void rawFileName(const char* prefix, int scanline, char* name, size_t size)
+{
+#ifdef _MSC_VER
+    _snprintf(name, size, "%s_scanline_%d.raw", prefix, scanline);
+#else
+    snprintf(name, size, "%s_scanline_%d.raw", prefix, scanline);
+#endif
+
+    // _snprintf does not terminate a name that does not fit
+    name[size - 1] = '\0';
+}
+
+// Long recordings go past 2 GB, so offsets are 64 bits on every compiler
+int rawSeek(FILE* fp, long long offset, int origin)
+{
+#ifdef _MSC_VER
+    return _fseeki64(fp, offset, origin);
+#else
+    return fseeko(fp, offset, origin);
+#endif
+}
+
+long long rawTell(FILE* fp)
+{
+#ifdef _MSC_VER
+    return _ftelli64(fp);
+#else
+    return ftello(fp);
+#endif
+}
+
+int rawDepthToSample(const _rawLayout& layout, int depth)
+{
+    // Two-way travel from the first stored depth
+    double seconds = 2e-6 * (depth - layout.saveDelay) / layout.speedOfSound;
+    double sample = seconds * layout.samplingFreq;
+
+    return (sample < 0.0) ? (int)(sample - 0.5) : (int)(sample + 0.5);
+}
+
+bool rawSetFrameSize(_rawLayout& layout, int frameSize)
+{
+    int lineBytes;
+
+    if (layout.channels < 1 || frameSize % (layout.channels * (int)sizeof(short)) != 0)
+    {
+        printf("ERROR: Frame size %d does not match %d channels\n", frameSize, layout.channels);
+        return false;
+    }
+
+    lineBytes = frameSize / layout.channels;
+    layout.numSamples = lineBytes / sizeof(short);
+
+    return true;
+}
+
+int rawGetNumFrames(const char* fileName, const _rawLayout& layout)
+{
+    long long size;
+    long long frameBytes = (long long)layout.channels * layout.numSamples * sizeof(short);
+    FILE* fpRaw = fopen(fileName, "rb");
+
+    if (!fpRaw)
+    {
+        printf("ERROR: Could not open file %s\n", fileName);
+        return -1;
+    }
+
+    rawSeek(fpRaw, 0, SEEK_END);
+    size = rawTell(fpRaw);
+    fclose(fpRaw);
+
+    return (frameBytes > 0) ? (int)(size / frameBytes) : -1;
+}
+
+bool rawReadWindow(const char* fileName, const _rawLayout& layout, int frame,
+                   int firstSample, int numSamples, int firstChannel, int numChannels, short* out)
+{
+    long long offset;
+    int c;
+    FILE* fpRaw;
+
+    if (frame < 0 || firstSample < 0 || numSamples < 1 || firstSample + numSamples > layout.numSamples ||
+        firstChannel < 0 || numChannels < 1 || firstChannel + numChannels > layout.channels)
+    {
+        printf("ERROR: Requested window is out of the stored data\n");
+        return false;
+    }
+
+    fpRaw = fopen(fileName, "rb");
+    if (!fpRaw)
+    {
+        printf("ERROR: Could not open file %s\n", fileName);
+        return false;
+    }
+
+    for (c = 0; c < numChannels; c++)
+    {
+        offset = (((long long)frame * layout.channels + firstChannel + c) * layout.numSamples + firstSample) *
+                 (long long)sizeof(short);
+
+        // When the window spans whole lines the next read is contiguous
+        if ((c == 0 || numSamples != layout.numSamples) && rawSeek(fpRaw, offset, SEEK_SET) != 0)
+        {
+            break;
+        }
+
+        if (fread(out + (size_t)c * numSamples, sizeof(short), numSamples, fpRaw) != (size_t)numSamples)
+        {
+            break;
+        }
+    }
+
+    fclose(fpRaw);
+
+    if (c < numChannels)
+    {
+        printf("ERROR: File %s does not have frame %d\n", fileName, frame);
+        return false;
+    }
+
+    return true;
+}
+
+bool rawReadDepthRange(const char* fileName, const _rawLayout& layout, int frame,
+                       int startDepth, int endDepth, int firstChannel, int numChannels,
+                       short* out, int* numSamplesOut)
+{
+    int first = rawDepthToSample(layout, startDepth);
+    int last = rawDepthToSample(layout, endDepth);
+
+    first = (first < 0) ? 0 : first;
+    last = (last > layout.numSamples) ? layout.numSamples : last;
+
+    if (first >= last)
+    {
+        printf("ERROR: Depth range %d to %d is out of the stored ROI\n", startDepth, endDepth);
+        return false;
+    }
+
+    *numSamplesOut = last - first;
+
+    return rawReadWindow(fileName, layout, frame, first, last - first, firstChannel, numChannels, out);
+}
+
+bool rawReadFrames(FILE* fpRaw, const _rawLayout& layout, int firstFrame, int numFrames, short* out)
+{
+    size_t frameSamples = (size_t)layout.channels * layout.numSamples;
+    long long offset = (long long)firstFrame * frameSamples * sizeof(short);
+
+    // Whole frames are contiguous, so this is a single sequential read
+    if (rawSeek(fpRaw, offset, SEEK_SET) != 0 ||
+        fread(out, sizeof(short) * frameSamples, numFrames, fpRaw) != (size_t)numFrames)
+    {
+        printf("ERROR: Could not read frames %d to %d\n", firstFrame, firstFrame + numFrames - 1);
+        return false;
+    }
+
+    return true;
+}
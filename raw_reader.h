@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdio.h>
+
+/// Size of a scanline file name buffer: a prefix of up to 511 characters and
+/// the scanline suffix
+#define RAW_MAX_PATH 540
+
+////////////////////////////////////////////////////////////////////////////////
+/// Layout of a scanline file written by saveData(). Each frame holds the
+/// lines of all channels, one after the other, with 16 bit samples.
+////////////////////////////////////////////////////////////////////////////////
+struct _rawLayout
+{
+    /// number of channels (lines) in each frame
+    int channels;
+    /// number of samples of each line
+    int numSamples;
+    /// sampling frequency in Hz
+    int samplingFreq;
+    /// speed of sound in m/s
+    int speedOfSound;
+    /// depth in microns of the first sample (rx.saveDelay)
+    int saveDelay;
+};
+
+/// Sampling frequency in Hz of a rx.decimation value
+int rawSamplingFreq(int decimation);
+
+/// Name of the file of a scanline, <prefix>_scanline_<scanline>.raw, as saved
+/// by saveData(). name holds size characters and is always terminated
+void rawFileName(const char* prefix, int scanline, char* name, size_t size);
+
+/// fseek and ftell with 64 bit offsets, for files past 2 GB
+int rawSeek(FILE* fp, long long offset, int origin);
+long long rawTell(FILE* fp);
+
+/// Index of the sample that holds the echo from a depth in microns. The
+/// result may fall outside [0, numSamples) when the depth is out of the ROI
+int rawDepthToSample(const _rawLayout& layout, int depth);
+
+/// Fill numSamples from the size of one frame in bytes (texoGetFrameSize())
+bool rawSetFrameSize(_rawLayout& layout, int frameSize);
+
+/// Number of complete frames stored in a scanline file, -1 on error
+int rawGetNumFrames(const char* fileName, const _rawLayout& layout);
+
+/// Read samples [firstSample, firstSample + numSamples) of channels
+/// [firstChannel, firstChannel + numChannels) of one frame. Only the requested
+/// bytes are read from the file. out[c * numSamples + n] holds sample n of
+/// channel firstChannel + c
+bool rawReadWindow(const char* fileName, const _rawLayout& layout, int frame,
+                   int firstSample, int numSamples, int firstChannel, int numChannels, short* out);
+
+/// Same as rawReadWindow() with the window given as a depth range in
+/// microns. The range is clipped to the stored ROI and the number of samples
+/// per channel written to out is returned in numSamplesOut
+bool rawReadDepthRange(const char* fileName, const _rawLayout& layout, int frame,
+                       int startDepth, int endDepth, int firstChannel, int numChannels,
+                       short* out, int* numSamplesOut);
+
+/// Read numFrames whole frames starting at firstFrame from an open file with
+/// one sequential read. out must hold numFrames * channels * numSamples samples
+bool rawReadFrames(FILE* fpRaw, const _rawLayout& layout, int firstFrame, int numFrames, short* out);
@@ -0,0 +1,492 @@
+/*
+ * @brief     Replay implementation of the texo acquisition interface
+ *
+ * @details   Each sequence built with texoBeginSequence()/texoEndSequence()
+ *            is bound to the next scanline file of a saved dataset, in the
+ *            same order used by the acquisition tool. The file is mapped in
+ *            memory and its frames are the cine buffer, so texoGetCineStart()
+ *            returns the mapping and the callback gets pointers into it with
+ *            no copy. While running, a thread delivers the frames to the
+ *            callback, looping over the file, either paced at the configured
+ *            frame rate or as fast as possible. The collected frame count
+ *            stops at the number of frames in the file, which is what the
+ *            cine holds.
+ *
+ *            The remaining functions only keep the state the tool expects.
+ */
+
+#include <windows.h>
+#include <mmsystem.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "texo.h"
+#include "texo_replay.h"
+#include "timing.h"
+#include "raw_reader.h"
+
+/// Size of the pages touched to load a file mapping before running
+#define REPLAY_PAGE_SIZE 4096
+
+// Dataset
+static char replayPrefix[RAW_MAX_PATH] = "";
+static int replayFrameSize = 0;
+static double replayFrameRate = 0.0;
+static bool replaySourceSet = false;
+
+// System and sequence state
+static int replayInitialized = 0;
+static int replayChannels = 64;
+static int replayProbeId = 0;
+static int replaySequence = -1;
+static int replayNumLines = 0;
+
+// Mapping of the current scanline file
+static HANDLE replayFile = INVALID_HANDLE_VALUE;
+static HANDLE replayMapping = NULL;
+static unsigned char* replayCine = NULL;
+static int replayNumFrames = 0;
+
+// Acquisition thread
+static TEXO_CALLBACK replayCallback = NULL;
+static void* replayCallbackPrm = NULL;
+static HANDLE replayThread = NULL;
+static volatile LONG replayRunning = 0;
+static volatile LONG replayCollected = 0;
+
+static void closeScanline()
+{
+    if (replayCine != NULL)
+    {
+        UnmapViewOfFile(replayCine);
+        replayCine = NULL;
+    }
+
+    if (replayMapping != NULL)
+    {
+        CloseHandle(replayMapping);
+        replayMapping = NULL;
+    }
+
+    if (replayFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(replayFile);
+        replayFile = INVALID_HANDLE_VALUE;
+    }
+
+    replayNumFrames = 0;
+}
+
+static bool openScanline(int scanline)
+{
+    char fileName[RAW_MAX_PATH];
+    LARGE_INTEGER size;
+    volatile unsigned char touch = 0;
+    long long i;
+
+    closeScanline();
+
+    rawFileName(replayPrefix, scanline, fileName, sizeof(fileName));
+
+    replayFile = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (replayFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(replayFile, &size))
+    {
+        printf("REPLAY: Could not open %s\n", fileName);
+        closeScanline();
+        return false;
+    }
+
+    replayNumFrames = (int)(size.QuadPart / replayFrameSize);
+
+    if (replayNumFrames < 1)
+    {
+        printf("REPLAY: %s is smaller than one frame of %d bytes\n", fileName, replayFrameSize);
+        closeScanline();
+        return false;
+    }
+
+    replayMapping = CreateFileMapping(replayFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    replayCine = (replayMapping != NULL) ?
+                 (unsigned char*)MapViewOfFile(replayMapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    if (replayCine == NULL)
+    {
+        printf("REPLAY: Could not map %s\n", fileName);
+        closeScanline();
+        return false;
+    }
+
+    // Load the whole file now, so page faults do not slow down the replay
+    for (i = 0; i < size.QuadPart; i += REPLAY_PAGE_SIZE)
+    {
+        touch += replayCine[i];
+    }
+
+    return true;
+}
+
+static DWORD WINAPI replayWorker(LPVOID)
+{
+    LARGE_INTEGER start, now, freq;
+    double due;
+    int frame = 0, wait;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    while (replayRunning)
+    {
+        if (replayFrameRate > 0.0)
+        {
+            // Pace against the start time so the rate does not drift
+            due = frame / replayFrameRate;
+            QueryPerformanceCounter(&now);
+            wait = (int)(1000.0 * (due - (double)(now.QuadPart - start.QuadPart) / freq.QuadPart));
+
+            if (wait > 0)
+            {
+                Sleep(wait);
+            }
+        }
+
+        if (replayCollected < replayNumFrames)
+        {
+            InterlockedIncrement(&replayCollected);
+        }
+
+        if (replayCallback != NULL)
+        {
+            replayCallback(replayCallbackPrm, replayCine + (size_t)(frame % replayNumFrames) * replayFrameSize,
+                           frame);
+        }
+
+        frame++;
+    }
+
+    return 0;
+}
+
+// A truncated prefix would replay the files of another dataset, so reject it
+static bool setPrefix(const char* prefix)
+{
+    if (strlen(prefix) >= sizeof(replayPrefix))
+    {
+        printf("REPLAY: Prefix too long, at most %d characters: %s\n", (int)sizeof(replayPrefix) - 1, prefix);
+        replayPrefix[0] = '\0';
+        return false;
+    }
+
+    strcpy(replayPrefix, prefix);
+    return true;
+}
+
+void texoReplaySetSource(const char* prefix, int frameSize, double frameRate)
+{
+    setPrefix(prefix);
+    replayFrameSize = frameSize;
+    replayFrameRate = frameRate;
+    replaySourceSet = true;
+}
+
+int texoInit(const char*, int, int, int, int channels, int, int, bool)
+{
+    const char* env;
+    const char* name;
+
+    if (!replaySourceSet)
+    {
+        env = getenv("TEXO_REPLAY_PREFIX");
+        if (!setPrefix((env != NULL) ? env : ""))
+        {
+            return 0;
+        }
+        env = getenv("TEXO_REPLAY_FRAMESIZE");
+        replayFrameSize = (env != NULL) ? atoi(env) : 0;
+        env = getenv("TEXO_REPLAY_FRAMERATE");
+        replayFrameRate = (env != NULL) ? atof(env) : 0.0;
+    }
+
+    if (replayPrefix[0] == '\0' || replayFrameSize <= 0)
+    {
+        printf("REPLAY: No dataset selected. Set TEXO_REPLAY_PREFIX and TEXO_REPLAY_FRAMESIZE\n");
+        return 0;
+    }
+
+    // The probe of the dataset is in its name: probeId_<id>_<mode>, after
+    // the last separator of either kind
+    name = replayPrefix + strlen(replayPrefix);
+    while (name > replayPrefix && name[-1] != '/' && name[-1] != '\\' && name[-1] != ':')
+    {
+        name--;
+    }
+
+    if (sscanf(name, "probeId_%d", &replayProbeId) != 1)
+    {
+        printf("REPLAY: No probe ID in the name %s, using 0\n", name);
+        replayProbeId = 0;
+    }
+
+    printf("REPLAY: %s, frame size %d bytes, %s\n", replayPrefix, replayFrameSize,
+           (replayFrameRate > 0.0) ? "real time" : "as fast as possible");
+
+    // Sleep() wakes up on the system timer, 15.6 ms by default, which would
+    // deliver the frames in bursts. Raise it to 1 ms while initialized
+    if (!replayInitialized)
+    {
+        timeBeginPeriod(1);
+    }
+
+    replayChannels = channels;
+    replaySequence = -1;
+    replayInitialized = 1;
+
+    return 1;
+}
+
+void texoShutdown()
+{
+    texoStopImage();
+    closeScanline();
+
+    if (replayInitialized)
+    {
+        timeEndPeriod(1);
+    }
+
+    replayInitialized = 0;
+}
+
+int texoIsInitialized()
+{
+    return replayInitialized;
+}
+
+int texoIsImaging()
+{
+    return replayRunning ? 1 : 0;
+}
+
+int texoActivateProbeConnector(int)
+{
+    return 1;
+}
+
+int texoSelectProbe(int)
+{
+    return 1;
+}
+
+int texoSelectOtherProbe(int)
+{
+    return 1;
+}
+
+int texoGetProbeName(int, char* name, int len)
+{
+    _snprintf(name, len, "replay");
+    name[len - 1] = '\0';
+    return 1;
+}
+
+int texoGetProbeCode(int)
+{
+    return replayProbeId;
+}
+
+int texoGetProbeNumElements()
+{
+    return 128;
+}
+
+int texoGetProbeCenterFreq()
+{
+    return 5000000;
+}
+
+int texoGetProbeHasMotor()
+{
+    return 0;
+}
+
+int texoGetProbeFOV()
+{
+    return 0;
+}
+
+int texoBeginSequence()
+{
+    if (replayRunning)
+    {
+        return 0;
+    }
+
+    replaySequence++;
+    replayNumLines = 0;
+
+    return 1;
+}
+
+int texoAddLine(_texoTransmitParams txPrms, _texoReceiveParams rxPrms, _texoLineInfo& lineInfo)
+{
+    _timingModel model;
+
+    replayNumLines++;
+    timingDefaultModel(model);
+
+    // The acquisition tool adds one line per channel. There is no scanner to
+    // measure the line, so report the duration predicted by the timing model
+    lineInfo.lineSize = replayFrameSize / replayChannels;
+    lineInfo.lineDuration = timingLineDuration(model, txPrms, rxPrms) / 1000;
+
+    return 1;
+}
+
+int texoEndSequence()
+{
+    if (!openScanline(replaySequence))
+    {
+        return -1;
+    }
+
+    replayCollected = 0;
+
+    return replayFrameSize;
+}
+
+void texoClearTGCs()
+{
+}
+
+int texoAddTGCFixed(double)
+{
+    return 1;
+}
+
+int texoAddTGC(_texoCurve*, int, double)
+{
+    return 1;
+}
+
+int texoAddReceive(_texoReceiveParams)
+{
+    return 1;
+}
+
+int texoAddTransmit(_texoTransmitParams)
+{
+    return 1;
+}
+
+int texoSetPower(int, int, int)
+{
+    return 1;
+}
+
+void texoSetVCAInfo(_vcaInfo)
+{
+}
+
+int texoRunImage()
+{
+    if (replayRunning || replayCine == NULL)
+    {
+        return 0;
+    }
+
+    replayCollected = 0;
+    replayRunning = 1;
+    replayThread = CreateThread(NULL, 0, replayWorker, NULL, 0, NULL);
+
+    if (replayThread == NULL)
+    {
+        replayRunning = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+int texoStopImage()
+{
+    if (!replayRunning)
+    {
+        return 1;
+    }
+
+    replayRunning = 0;
+    WaitForSingleObject(replayThread, INFINITE);
+    CloseHandle(replayThread);
+    replayThread = NULL;
+
+    return 1;
+}
+
+void texoSetCallback(TEXO_CALLBACK fn, void* prm)
+{
+    replayCallback = fn;
+    replayCallbackPrm = prm;
+}
+
+double texoGetFrameRate()
+{
+    return replayFrameRate;
+}
+
+int texoGetFrameSize()
+{
+    return replayFrameSize;
+}
+
+int texoGetMaxFrameCount()
+{
+    return replayNumFrames;
+}
+
+int texoGetCollectedFrameCount()
+{
+    return replayCollected;
+}
+
+unsigned char* texoGetCineStart(unsigned int)
+{
+    return replayCine;
+}
+
+int texoSetDelayReadBack(const char*)
+{
+    return 0;
+}
+
+void texoCloseDelayReadBack()
+{
+}
+
+void texoSetSyncSignals(int, int, int)
+{
+}
+
+void texoEnableSyncNotify(int)
+{
+}
+
+int texoSetupMotor(int, int, int)
+{
+    return 0;
+}
+
+double texoGoToPosition(double)
+{
+    return 0.0;
+}
+
+double texoStepMotor(int, int)
+{
+    return 0.0;
+}
+
+void texoForceConnector(int)
+{
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+/// Replay backend: texo_replay.cpp implements the functions of texo.h with
+/// the scanline files saved by a previous acquisition instead of the scanner.
+/// Link it in place of the texo library.
+////////////////////////////////////////////////////////////////////////////////
+
+/// Select the dataset to replay. Must be called before texoInit(); if it is
+/// not, texoInit() reads the environment variables TEXO_REPLAY_PREFIX,
+/// TEXO_REPLAY_FRAMESIZE and TEXO_REPLAY_FRAMERATE instead.
+/// prefix: file name prefix, e.g. data/probeId_2_singleRx. The n-th sequence
+///         (texoBeginSequence() call) serves "<prefix>_scanline_<n>.raw".
+///         A prefix of RAW_MAX_PATH characters or more is rejected and
+///         texoInit() fails
+/// frameSize: size of each frame in bytes, as printed in the acquisition log
+/// frameRate: frames per second to pace the replay, 0 to deliver the frames
+///            as fast as possible
+void texoReplaySetSource(const char* prefix, int frameSize, double frameRate);
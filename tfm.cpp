@@ -0,0 +1,328 @@
+/*
+ * @brief     Total focusing method (TFM) reconstruction of full matrix data
+ *
+ * @details   The singleTx acquisition fires one element at a time and stores
+ *            the signal of every channel, so for each pixel the echo of each
+ *            transmit/receive pair can be picked at the exact two-way time of
+ *            flight. This gives dynamic focus on transmit and receive over the
+ *            whole image instead of a single txFocusDistance.
+ *
+ *            The one-way time of flight from each element to each pixel is
+ *            computed once per geometry and cached. The cache is shared by
+ *            concurrent tfmReconstruct() calls: it is guarded by a spin lock
+ *            and a table is not evicted while a reconstruction uses it. The image is split in
+ *            tiles of rows that are processed in parallel, and the inner loop
+ *            over pixels is the SIMD interpolation kernel of kernels.h.
+ *
+ * @sa        Holmes, Drinkwater and Wilcox, "Post-processing of the full matrix
+ *            of ultrasonic transmit-receive array data for non-destructive
+ *            evaluation", NDT & E International 38 (2005)
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "tfm.h"
+#include "parallel.h"
+#include "raw_reader.h"
+#include "kernels.h"
+
+/// Number of image rows processed by each work item
+#define TFM_TILE_ROWS 8
+
+/// Maximum number of geometries kept in the time-of-flight cache
+#define TFM_CACHE_SIZE 4
+
+// Time of flight table of one geometry. tof[e * nx * nz + p] holds the one
+// way time from element e to pixel p in samples, minus half of the delay of
+// the first stored sample, so that tof[tx] + tof[rx] is a sample index
+struct _tfmTofTable
+{
+    _tfmGeometry geo;
+    float* tof;
+    /// number of reconstructions using the table
+    int users;
+    /// tfmClearCache() was called while in use: free it when unused
+    bool cleared;
+};
+
+static _tfmTofTable tofCache[TFM_CACHE_SIZE];
+static int tofCacheNext = 0;
+static volatile LONG tofCacheLock = 0;
+
+// Arguments of the per-tile work item
+struct _tfmJob
+{
+    const _tfmGeometry* geo;
+    const short* fmc;
+    const float* tof;
+    float* image;
+    int numTiles;
+    KERNEL_INTERPOLATE interpolate;
+};
+
+static bool sameGeometry(const _tfmGeometry& a, const _tfmGeometry& b)
+{
+    return (a.numElements == b.numElements) && (a.pitch == b.pitch) &&
+           (a.speedOfSound == b.speedOfSound) && (a.samplingFreq == b.samplingFreq) &&
+           (a.saveDelay == b.saveDelay) && (a.xStart == b.xStart) && (a.dx == b.dx) &&
+           (a.nx == b.nx) && (a.zStart == b.zStart) && (a.dz == b.dz) && (a.nz == b.nz);
+}
+
+static void lockCache()
+{
+    while (InterlockedCompareExchange(&tofCacheLock, 1, 0) != 0)
+    {
+        Sleep(0);
+    }
+}
+
+static void unlockCache()
+{
+    InterlockedExchange(&tofCacheLock, 0);
+}
+
+// Cached table of a geometry, marked as used. Call with the lock held
+static float* findTofTable(const _tfmGeometry& geo)
+{
+    int i;
+
+    for (i = 0; i < TFM_CACHE_SIZE; i++)
+    {
+        if (tofCache[i].tof != NULL && !tofCache[i].cleared && sameGeometry(tofCache[i].geo, geo))
+        {
+            tofCache[i].users++;
+            return tofCache[i].tof;
+        }
+    }
+
+    return NULL;
+}
+
+// Find the table of a geometry or compute it, replacing the oldest unused
+// entry. Must be paired with releaseTofTable()
+static const float* getTofTable(const _tfmGeometry& geo)
+{
+    int e, ix, iz, i, n;
+    int numPixels = geo.nx * geo.nz;
+    double samplesPerMicron, halfStart, xe, x, z;
+    float* tof;
+    float* cached;
+
+    lockCache();
+    cached = findTofTable(geo);
+    unlockCache();
+
+    if (cached != NULL)
+    {
+        return cached;
+    }
+
+    // Computed without the lock, other geometries stay available meanwhile
+    tof = (float*)malloc(sizeof(float) * geo.numElements * numPixels);
+
+    if (tof == NULL)
+    {
+        printf("ERROR: Not enough memory for the time of flight table\n");
+        return NULL;
+    }
+
+    samplesPerMicron = 1e-6 * geo.samplingFreq / geo.speedOfSound;
+    // The first stored sample is the echo from saveDelay, a two-way path
+    halfStart = geo.saveDelay * samplesPerMicron;
+
+    for (e = 0; e < geo.numElements; e++)
+    {
+        xe = (e - (geo.numElements - 1) / 2.0) * geo.pitch;
+
+        for (iz = 0; iz < geo.nz; iz++)
+        {
+            z = geo.zStart + iz * geo.dz;
+
+            for (ix = 0; ix < geo.nx; ix++)
+            {
+                x = geo.xStart + ix * geo.dx;
+                tof[e * numPixels + iz * geo.nx + ix] =
+                    (float)(sqrt((x - xe) * (x - xe) + z * z) * samplesPerMicron - halfStart);
+            }
+        }
+    }
+
+    lockCache();
+
+    // Another call may have computed the same table meanwhile
+    cached = findTofTable(geo);
+
+    for (n = 0; cached == NULL && n < TFM_CACHE_SIZE; n++)
+    {
+        i = tofCacheNext;
+        tofCacheNext = (tofCacheNext + 1) % TFM_CACHE_SIZE;
+
+        if (tofCache[i].users == 0)
+        {
+            free(tofCache[i].tof);
+            tofCache[i].geo = geo;
+            tofCache[i].tof = tof;
+            tofCache[i].users = 1;
+            tofCache[i].cleared = false;
+            cached = tof;
+        }
+    }
+
+    unlockCache();
+
+    // When every entry is in use the table is only kept for this call
+    if (cached != tof && cached != NULL)
+    {
+        free(tof);
+        return cached;
+    }
+
+    return tof;
+}
+
+// End of the use of a table returned by getTofTable()
+static void releaseTofTable(const float* tof)
+{
+    bool cached = false;
+    int i;
+
+    lockCache();
+
+    for (i = 0; i < TFM_CACHE_SIZE; i++)
+    {
+        if (tofCache[i].tof == tof)
+        {
+            tofCache[i].users--;
+            cached = true;
+
+            if (tofCache[i].cleared && tofCache[i].users == 0)
+            {
+                free(tofCache[i].tof);
+                tofCache[i].tof = NULL;
+                tofCache[i].cleared = false;
+            }
+        }
+    }
+
+    unlockCache();
+
+    if (!cached)
+    {
+        free((void*)tof);
+    }
+}
+
+// Reconstruct the rows of one tile
+static void reconstructTile(void* prm, int tile)
+{
+    _tfmJob* job = (_tfmJob*)prm;
+    const _tfmGeometry& geo = *job->geo;
+    int numPixels = geo.nx * geo.nz;
+    int firstRow = tile * TFM_TILE_ROWS;
+    int rows = (firstRow + TFM_TILE_ROWS > geo.nz) ? geo.nz - firstRow : TFM_TILE_ROWS;
+    int first = firstRow * geo.nx;
+    int count = rows * geo.nx;
+    int tx, rx;
+    float* acc = job->image + first;
+    const short* line;
+
+    memset(acc, 0, sizeof(float) * count);
+
+    for (tx = 0; tx < geo.numElements; tx++)
+    {
+        for (rx = 0; rx < geo.numElements; rx++)
+        {
+            line = job->fmc + ((size_t)tx * geo.numElements + rx) * geo.numSamples;
+
+            job->interpolate(line, geo.numSamples, job->tof + (size_t)tx * numPixels + first,
+                           job->tof + (size_t)rx * numPixels + first, acc, count);
+        }
+    }
+}
+
+bool tfmLoadFullMatrix(const char* prefix, const _tfmGeometry& geo, int frame, short* fmc)
+{
+    char fileName[RAW_MAX_PATH];
+    _rawLayout layout;
+    int tx;
+
+    layout.channels = geo.numElements;
+    layout.numSamples = geo.numSamples;
+    layout.samplingFreq = geo.samplingFreq;
+    layout.speedOfSound = geo.speedOfSound;
+    layout.saveDelay = geo.saveDelay;
+
+    // Each transmit element was saved as a scanline file with all channels
+    for (tx = 0; tx < geo.numElements; tx++)
+    {
+        rawFileName(prefix, tx, fileName, sizeof(fileName));
+
+        if (!rawReadWindow(fileName, layout, frame, 0, geo.numSamples, 0, geo.numElements,
+                           fmc + (size_t)tx * geo.numElements * geo.numSamples))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tfmReconstruct(const _tfmGeometry& geo, const short* fmc, float* image, int numThreads)
+{
+    _tfmJob job;
+    _kernelSet kernels;
+
+    if (geo.numElements < 1 || geo.numSamples < 2 || geo.nx < 1 || geo.nz < 1)
+    {
+        printf("ERROR: Invalid TFM geometry\n");
+        return false;
+    }
+
+    job.geo = &geo;
+    job.fmc = fmc;
+    job.image = image;
+    job.tof = getTofTable(geo);
+    job.numTiles = (geo.nz + TFM_TILE_ROWS - 1) / TFM_TILE_ROWS;
+
+    // Only the interpolation kernel is used, it does not depend on the counts
+    kernelSelect(geo.numElements, 0, kernelDetectIsa(), kernels);
+    job.interpolate = kernels.interpolate;
+
+    if (job.tof == NULL)
+    {
+        return false;
+    }
+
+    parallelFor(job.numTiles, reconstructTile, &job, numThreads);
+
+    releaseTofTable(job.tof);
+
+    return true;
+}
+
+void tfmClearCache()
+{
+    int i;
+
+    lockCache();
+
+    // Tables in use are freed by the last reconstruction using them
+    for (i = 0; i < TFM_CACHE_SIZE; i++)
+    {
+        if (tofCache[i].users == 0)
+        {
+            free(tofCache[i].tof);
+            tofCache[i].tof = NULL;
+        }
+        else
+        {
+            tofCache[i].cleared = true;
+        }
+    }
+
+    unlockCache();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+/// Geometry of a full matrix capture and of the reconstructed image.
+/// Distances follow the texo convention and are given in microns.
+////////////////////////////////////////////////////////////////////////////////
+struct _tfmGeometry
+{
+    /// number of elements used both to transmit and to receive
+    int numElements;
+    /// distance between the centers of two neighbour elements in microns
+    double pitch;
+    /// speed of sound in m/s
+    int speedOfSound;
+    /// sampling frequency of the stored lines in Hz
+    int samplingFreq;
+    /// number of samples of each stored line
+    int numSamples;
+    /// depth in microns of the first stored sample (rx.saveDelay)
+    int saveDelay;
+    /// lateral position of the first image column in microns (0 = array center)
+    double xStart;
+    /// lateral distance between image columns in microns
+    double dx;
+    /// number of image columns
+    int nx;
+    /// depth of the first image row in microns
+    double zStart;
+    /// depth distance between image rows in microns
+    double dz;
+    /// number of image rows
+    int nz;
+};
+
+/// Load the full matrix of one frame from the files written by the singleTx
+/// mode. Lines are stored as fmc[(tx * numElements + rx) * numSamples + n]
+bool tfmLoadFullMatrix(const char* prefix, const _tfmGeometry& geo, int frame, short* fmc);
+
+/// Total focusing method: delay and sum every transmit/receive pair for each
+/// pixel. The image is stored row by row, image[iz * nx + ix].
+/// numThreads = 0 uses one thread per processor. Several threads may reconstruct
+/// at the same time, the time-of-flight cache is shared safely
+bool tfmReconstruct(const _tfmGeometry& geo, const short* fmc, float* image, int numThreads = 0);
+
+/// Release the time-of-flight tables cached by tfmReconstruct(). Tables used
+/// by a running reconstruction are released when it ends
+void tfmClearCache();
@@ -0,0 +1,271 @@
+/*
+ * @brief     Check of the TFM reconstruction against a direct delay and sum
+ *
+ * @details   Writes the singleTx files of a simulated point scatterer, loads
+ *            them back with tfmLoadFullMatrix() and reconstructs the image with
+ *            tfmReconstruct(). The image must match a delay and sum computed
+ *            pixel by pixel in double precision, and its peak must be at the
+ *            scatterer. Then several reconstructions of more geometries than
+ *            the time-of-flight cache holds run at the same time and must give
+ *            the same images.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "tfm.h"
+#include "parallel.h"
+#include "raw_reader.h"
+
+#define PI 3.14159265358979323846
+
+/// Position of the simulated scatterer in microns
+#define SCATTERER_X 1200.0
+#define SCATTERER_Z 12000.0
+
+/// Frames of each simulated file, the check reads the last one
+#define NUM_FRAMES 2
+
+/// Concurrent reconstructions and geometries they cycle through
+#define NUM_RUNS 12
+#define NUM_GEOMETRIES 6
+
+/// Largest error allowed relative to the peak of the image
+#define MAX_ERROR 1e-4
+
+struct _checkRun
+{
+    const _tfmGeometry* geos;
+    const short* fmc;
+    const float* expected;
+    float* images;
+    volatile long failed;
+};
+
+static double elementX(const _tfmGeometry& geo, int e)
+{
+    return (e - (geo.numElements - 1) / 2.0) * geo.pitch;
+}
+
+// Write the singleTx files of a point scatterer: a 5 MHz pulse at the two-way
+// time of flight of each transmit/receive pair
+static bool writeScatterer(const char* prefix, const _tfmGeometry& geo)
+{
+    int tx, rx, n, frame;
+    size_t lineSize = geo.numSamples;
+    short* line = (short*)malloc(sizeof(short) * lineSize);
+    double samplesPerMicron = 1e-6 * geo.samplingFreq / geo.speedOfSound;
+    double delay, t, dTx, dRx;
+    char fileName[RAW_MAX_PATH];
+    FILE* fp;
+
+    if (line == NULL)
+    {
+        return false;
+    }
+
+    for (tx = 0; tx < geo.numElements; tx++)
+    {
+        rawFileName(prefix, tx, fileName, sizeof(fileName));
+        fp = fopen(fileName, "wb");
+        if (!fp)
+        {
+            printf("ERROR: Could not create file %s\n", fileName);
+            free(line);
+            return false;
+        }
+
+        dTx = sqrt(pow(SCATTERER_X - elementX(geo, tx), 2) + SCATTERER_Z * SCATTERER_Z);
+
+        for (frame = 0; frame < NUM_FRAMES; frame++)
+        {
+            for (rx = 0; rx < geo.numElements; rx++)
+            {
+                dRx = sqrt(pow(SCATTERER_X - elementX(geo, rx), 2) + SCATTERER_Z * SCATTERER_Z);
+                delay = (dTx + dRx - 2.0 * geo.saveDelay) * samplesPerMicron;
+
+                for (n = 0; n < geo.numSamples; n++)
+                {
+                    t = (n - delay) / geo.samplingFreq;
+                    line[n] = (frame == NUM_FRAMES - 1) ?
+                        (short)(1000.0 * exp(-t * t / 1e-13) * cos(2 * PI * 5e6 * t)) : 0;
+                }
+
+                fwrite(line, sizeof(short), lineSize, fp);
+            }
+        }
+
+        fclose(fp);
+    }
+
+    free(line);
+
+    return true;
+}
+
+// Delay and sum of every pixel, in double precision
+static void directSum(const _tfmGeometry& geo, const short* fmc, float* image)
+{
+    double samplesPerMicron = 1e-6 * geo.samplingFreq / geo.speedOfSound;
+    double x, z, t, sum, dTx, dRx;
+    const short* line;
+    int ix, iz, tx, rx, n;
+
+    for (iz = 0; iz < geo.nz; iz++)
+    {
+        z = geo.zStart + iz * geo.dz;
+
+        for (ix = 0; ix < geo.nx; ix++)
+        {
+            x = geo.xStart + ix * geo.dx;
+            sum = 0.0;
+
+            for (tx = 0; tx < geo.numElements; tx++)
+            {
+                dTx = sqrt(pow(x - elementX(geo, tx), 2) + z * z);
+
+                for (rx = 0; rx < geo.numElements; rx++)
+                {
+                    dRx = sqrt(pow(x - elementX(geo, rx), 2) + z * z);
+                    t = (dTx + dRx - 2.0 * geo.saveDelay) * samplesPerMicron;
+                    n = (int)t;
+
+                    if (t >= 0.0 && n < geo.numSamples - 1)
+                    {
+                        line = fmc + ((size_t)tx * geo.numElements + rx) * geo.numSamples;
+                        sum += line[n] + (t - n) * (line[n + 1] - line[n]);
+                    }
+                }
+            }
+
+            image[iz * geo.nx + ix] = (float)sum;
+        }
+    }
+}
+
+static void concurrentTask(void* prm, int i)
+{
+    _checkRun* run = (_checkRun*)prm;
+    int g = i % NUM_GEOMETRIES;
+    int numPixels = run->geos[0].nx * run->geos[0].nz;
+    float* image = run->images + (size_t)i * numPixels;
+
+    if (!tfmReconstruct(run->geos[g], run->fmc, image, 1) ||
+        memcmp(image, run->expected + (size_t)g * numPixels, sizeof(float) * numPixels) != 0)
+    {
+        run->failed = 1;
+    }
+
+    // Force evictions while other reconstructions hold their tables
+    if (i % 4 == 3)
+    {
+        tfmClearCache();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const char* prefix = (argc > 1) ? argv[1] : "tfm_check";
+    _tfmGeometry geo, geos[NUM_GEOMETRIES];
+    _checkRun run;
+    int numPixels, p, peak = 0, g, tx;
+    double maxRef = 0.0, maxError = 0.0, peakX, peakZ;
+    short* fmc;
+    float* image;
+    float* reference;
+    float* images;
+    char fileName[RAW_MAX_PATH];
+    bool ok;
+
+    geo.numElements = 32;
+    geo.pitch = 300.0;
+    geo.speedOfSound = 1540;
+    geo.samplingFreq = 40000000;
+    geo.numSamples = 1200;
+    geo.saveDelay = 3000;
+    geo.xStart = -4800.0;
+    geo.dx = 150.0;
+    geo.nx = 64;
+    geo.zStart = 6000.0;
+    geo.dz = 150.0;
+    geo.nz = 80;
+
+    numPixels = geo.nx * geo.nz;
+    fmc = (short*)malloc(sizeof(short) * geo.numElements * geo.numElements * geo.numSamples);
+    image = (float*)malloc(sizeof(float) * numPixels);
+    reference = (float*)malloc(sizeof(float) * numPixels);
+    images = (float*)malloc(sizeof(float) * numPixels * (NUM_GEOMETRIES + NUM_RUNS));
+
+    if (fmc == NULL || image == NULL || reference == NULL || images == NULL)
+    {
+        printf("ERROR: Not enough memory\n");
+        return -1;
+    }
+
+    ok = writeScatterer(prefix, geo) && tfmLoadFullMatrix(prefix, geo, NUM_FRAMES - 1, fmc) &&
+         tfmReconstruct(geo, fmc, image);
+
+    for (tx = 0; tx < geo.numElements; tx++)
+    {
+        rawFileName(prefix, tx, fileName, sizeof(fileName));
+        remove(fileName);
+    }
+
+    if (!ok)
+    {
+        printf("ERROR: Reconstruction failed\n");
+        return -1;
+    }
+
+    directSum(geo, fmc, reference);
+
+    for (p = 0; p < numPixels; p++)
+    {
+        maxRef = (fabs(reference[p]) > maxRef) ? fabs(reference[p]) : maxRef;
+        maxError = (fabs(image[p] - reference[p]) > maxError) ? fabs(image[p] - reference[p]) : maxError;
+        peak = (fabs(image[p]) > fabs(image[peak])) ? p : peak;
+    }
+
+    peakX = geo.xStart + (peak % geo.nx) * geo.dx;
+    peakZ = geo.zStart + (peak / geo.nx) * geo.dz;
+
+    printf("Largest error relative to the peak: %.2e\n", maxError / maxRef);
+    printf("Peak at x = %.0f um, z = %.0f um (scatterer at x = %.0f um, z = %.0f um)\n",
+           peakX, peakZ, SCATTERER_X, SCATTERER_Z);
+
+    ok = (maxError <= MAX_ERROR * maxRef) && (fabs(peakX - SCATTERER_X) <= geo.dx) &&
+         (fabs(peakZ - SCATTERER_Z) <= geo.dz);
+
+    // Geometries that differ by their first row, each reconstructed alone
+    for (g = 0; g < NUM_GEOMETRIES; g++)
+    {
+        geos[g] = geo;
+        geos[g].zStart = geo.zStart + g * geo.dz;
+        ok = tfmReconstruct(geos[g], fmc, images + (size_t)g * numPixels) && ok;
+    }
+
+    run.geos = geos;
+    run.fmc = fmc;
+    run.expected = images;
+    run.images = images + (size_t)NUM_GEOMETRIES * numPixels;
+    run.failed = 0;
+
+    tfmClearCache();
+    parallelFor(NUM_RUNS, concurrentTask, &run, 4);
+
+    printf("Concurrent reconstructions: %s\n", run.failed ? "FAILED" : "identical");
+
+    ok = ok && !run.failed;
+
+    tfmClearCache();
+    free(fmc);
+    free(image);
+    free(reference);
+    free(images);
+
+    printf("%s\n", ok ? "TFM check passed" : "TFM check FAILED");
+
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,299 @@
+/*
+ * @brief     Offline timing model of texo sequences
+ *
+ * @details   The frame rate is only known after texoEndSequence() on the
+ *            scanner. This model predicts it from the parameters of each line
+ *            so sequences can be planned offline:
+ *
+ *            line = txDelay + max(pulse + round trip + overhead, transfer)
+ *
+ *            where the pulse lasts one half period per character of the pulse
+ *            shape for each of the txRepeat + 1 repetitions, the round trip is
+ *            to rx.acquisitionDepth and the transfer moves the samples between
+ *            rx.saveDelay and rx.acquisitionDepth at the sampling frequency set
+ *            by rx.decimation. rx.customLineDuration can only make a line
+ *            longer. Texo fires the lines back to back, so the frame lasts the
+ *            sum of its lines.
+ *
+ *            For the echoes of a firing not to show up in the next firing of
+ *            an overlapping transmit aperture, the two must be apart by the
+ *            settling time. The hardware does not wait for it, so it is added
+ *            as rx.customLineDuration padding, and the line order decides how
+ *            much padding is needed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "timing.h"
+
+/// Sampling frequency of the receive hardware without decimation
+#define TIMING_BASE_SAMPLING_FREQ 40000000
+
+// A distinct transmit (position and aperture) and the lines that use it
+struct _timingGroup
+{
+    double center;
+    int aperture;
+    // Lines of the group in their original order and the next one to fire
+    int* lines;
+    int numLines;
+    int next;
+    // Start time of the last firing of the group in nanoseconds, and the
+    // settling time that must pass after it
+    double lastStart;
+    double settling;
+};
+
+void timingDefaultModel(_timingModel& model)
+{
+    model.lineOverhead = 10000;
+    model.transferRate = 200e6;
+    model.reverbFactor = 2.0;
+    model.settlingGuard = 0;
+    model.calibrated = false;
+}
+
+static double roundTrip(const _texoReceiveParams& rx)
+{
+    // microns over m/s gives microseconds, times 1000 for nanoseconds
+    return 2000.0 * rx.acquisitionDepth / rx.speedOfSound;
+}
+
+int timingLineDuration(const _timingModel& model, const _texoTransmitParams& tx, const _texoReceiveParams& rx)
+{
+    double pulse, acquisition, samples, transfer, line;
+
+    pulse = (tx.frequency > 0) ? strlen(tx.pulseShape) * (tx.txRepeat + 1) * 1e9 / (2.0 * tx.frequency) : 0.0;
+    acquisition = pulse + roundTrip(rx) + model.lineOverhead;
+
+    samples = 2e-6 * (rx.acquisitionDepth - rx.saveDelay) / rx.speedOfSound * (TIMING_BASE_SAMPLING_FREQ >> rx.decimation);
+    transfer = 1e9 * samples * sizeof(short) / model.transferRate;
+
+    line = tx.txDelay + ((acquisition > transfer) ? acquisition : transfer);
+
+    if (rx.customLineDuration > line)
+    {
+        line = rx.customLineDuration;
+    }
+
+    return (int)(line + 0.5);
+}
+
+static bool overlap(const _timingModel& model, const _timingGroup& a, const _timingGroup& b)
+{
+    double distance = (a.center > b.center) ? a.center - b.center : b.center - a.center;
+
+    // An aperture of 0 fires a single element
+    return distance < (a.aperture + b.aperture) / 2.0 + 1 + model.settlingGuard;
+}
+
+// Group the lines by transmit and fill the group of each line
+static bool makeGroups(const _timingLine* lines, int numLines, _timingGroup* groups, int* groupOf, int& numGroups)
+{
+    int i, g;
+
+    numGroups = 0;
+
+    for (i = 0; i < numLines; i++)
+    {
+        for (g = 0; g < numGroups; g++)
+        {
+            if (groups[g].center == lines[i].tx.centerElement && groups[g].aperture == lines[i].tx.aperture)
+            {
+                break;
+            }
+        }
+
+        if (g == numGroups)
+        {
+            groups[g].center = lines[i].tx.centerElement;
+            groups[g].aperture = lines[i].tx.aperture;
+            groups[g].lines = (int*)malloc(sizeof(int) * numLines);
+            groups[g].numLines = 0;
+            groups[g].next = 0;
+            groups[g].lastStart = 0.0;
+            groups[g].settling = 0.0;
+            numGroups++;
+
+            if (groups[g].lines == NULL)
+            {
+                return false;
+            }
+        }
+
+        groups[g].lines[groups[g].numLines++] = i;
+        groupOf[i] = g;
+    }
+
+    return true;
+}
+
+static void freeGroups(_timingGroup* groups, int numGroups)
+{
+    int g;
+
+    for (g = 0; g < numGroups; g++)
+    {
+        free(groups[g].lines);
+    }
+}
+
+// Earliest time a line of group g can start, given the current time
+static double earliestStart(const _timingModel& model, const _timingGroup* groups, int numGroups,
+                            const bool* fired, int g, double now)
+{
+    double start = now;
+    int h;
+
+    for (h = 0; h < numGroups; h++)
+    {
+        if (fired[h] && overlap(model, groups[g], groups[h]) && groups[h].lastStart + groups[h].settling > start)
+        {
+            start = groups[h].lastStart + groups[h].settling;
+        }
+    }
+
+    return start;
+}
+
+// Walk the lines in order (or pick them greedily when greedy is set, writing
+// the chosen order), pad each line so the next one starts after the settling
+// time and return the padded frame duration
+static double schedule(const _timingModel& model, const _timingLine* lines, int numLines,
+                       const int* order, bool greedy, int* chosen, int* customLineDuration)
+{
+    _timingGroup* groups = (_timingGroup*)malloc(sizeof(_timingGroup) * numLines);
+    int* groupOf = (int*)malloc(sizeof(int) * numLines);
+    bool* fired = (bool*)calloc(numLines, sizeof(bool));
+    double now = 0.0, start, best, wait;
+    int numGroups = 0, i, g, line, bestGroup, duration = 0;
+    bool ok = (groups != NULL && groupOf != NULL && fired != NULL) &&
+              makeGroups(lines, numLines, groups, groupOf, numGroups);
+
+    for (i = 0; ok && i < numLines; i++)
+    {
+        if (greedy)
+        {
+            // The group that can fire first; ties go to the earliest line
+            bestGroup = -1;
+            best = 0.0;
+
+            for (g = 0; g < numGroups; g++)
+            {
+                if (groups[g].next == groups[g].numLines)
+                {
+                    continue;
+                }
+
+                start = earliestStart(model, groups, numGroups, fired, g, now);
+
+                if (bestGroup < 0 || start < best ||
+                    (start == best && groups[g].lines[groups[g].next] < groups[bestGroup].lines[groups[bestGroup].next]))
+                {
+                    bestGroup = g;
+                    best = start;
+                }
+            }
+
+            line = groups[bestGroup].lines[groups[bestGroup].next++];
+            chosen[i] = line;
+        }
+        else
+        {
+            line = (order != NULL) ? order[i] : i;
+        }
+
+        g = groupOf[line];
+        start = earliestStart(model, groups, numGroups, fired, g, now);
+
+        // Lengthen the previous line up to the start of this one
+        wait = start - now;
+        if (wait > 0.0 && i > 0)
+        {
+            duration += (int)(wait + 0.999);
+            customLineDuration[i - 1] = duration;
+            start = now + (int)(wait + 0.999);
+        }
+
+        customLineDuration[i] = lines[line].rx.customLineDuration;
+
+        groups[g].lastStart = start;
+        groups[g].settling = model.reverbFactor * roundTrip(lines[line].rx);
+        fired[g] = true;
+
+        duration = timingLineDuration(model, lines[line].tx, lines[line].rx);
+        now = start + duration;
+    }
+
+    freeGroups(groups, numGroups);
+
+    free(groups);
+    free(groupOf);
+    free(fired);
+
+    if (!ok)
+    {
+        printf("ERROR: Not enough memory for the timing model\n");
+        return -1.0;
+    }
+
+    return now;
+}
+
+double timingSequenceDuration(const _timingModel& model, const _timingLine* lines, int numLines)
+{
+    double duration = 0.0;
+    int i;
+
+    for (i = 0; i < numLines; i++)
+    {
+        duration += timingLineDuration(model, lines[i].tx, lines[i].rx);
+    }
+
+    return duration;
+}
+
+double timingSettle(const _timingModel& model, const _timingLine* lines, int numLines, const int* order,
+                    int* customLineDuration)
+{
+    return schedule(model, lines, numLines, order, false, NULL, customLineDuration);
+}
+
+bool timingOptimizeOrder(const _timingModel& model, const _timingLine* lines, int numLines, int* order)
+{
+    int* padding = (int*)malloc(sizeof(int) * numLines);
+    bool ok = (padding != NULL) && schedule(model, lines, numLines, NULL, true, order, padding) >= 0.0;
+
+    free(padding);
+
+    return ok;
+}
+
+void timingCalibrate(_timingModel& model, const _timingLine* lines, int numLines, double measuredFrameRate)
+{
+    double predicted;
+    int i;
+
+    if (measuredFrameRate <= 0.0 || numLines < 1)
+    {
+        return;
+    }
+
+    // Spread the difference evenly over the lines. Lines set by the transfer
+    // or by customLineDuration do not follow the overhead, so repeat a few
+    // times to converge
+    for (i = 0; i < 4; i++)
+    {
+        predicted = timingSequenceDuration(model, lines, numLines);
+        model.lineOverhead += (int)((1e9 / measuredFrameRate - predicted) / numLines);
+
+        if (model.lineOverhead < 0)
+        {
+            model.lineOverhead = 0;
+        }
+    }
+
+    model.calibrated = true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "texo_def.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// Constants of the offline timing model. The defaults are estimates that have
+/// not been checked against a scanner: fit them with timingCalibrate() and the
+/// frame rate printed by printStats() before trusting a prediction.
+////////////////////////////////////////////////////////////////////////////////
+struct _timingModel
+{
+    /// fixed time of each line in nanoseconds (sequencer setup, mask loading)
+    int lineOverhead;
+    /// rate in bytes per second at which line data leaves the receive hardware
+    double transferRate;
+    /// time, in multiples of the round trip to the acquisition depth, that a
+    /// firing must settle (reverberations decay) before an overlapping
+    /// aperture, the same one included, fires again
+    double reverbFactor;
+    /// extra elements between two transmit apertures for them to be
+    /// considered not overlapping
+    int settlingGuard;
+    /// true once timingCalibrate() fitted the model to a measured frame rate
+    bool calibrated;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// One line of a sequence, as passed to texoAddLine().
+////////////////////////////////////////////////////////////////////////////////
+struct _timingLine
+{
+    _texoTransmitParams tx;
+    _texoReceiveParams rx;
+};
+
+/// Fill the model with the default estimates (not calibrated)
+void timingDefaultModel(_timingModel& model);
+
+/// Predicted duration of a line in nanoseconds, from the pulse length,
+/// txRepeat, txDelay, the round trip to rx.acquisitionDepth, the data volume
+/// set by the depth window and rx.decimation, and rx.customLineDuration
+int timingLineDuration(const _timingModel& model, const _texoTransmitParams& tx, const _texoReceiveParams& rx);
+
+/// Predicted duration of a frame in nanoseconds. Texo fires the lines back to
+/// back, so this is the sum of the line durations whatever their order
+double timingSequenceDuration(const _timingModel& model, const _timingLine* lines, int numLines);
+
+/// Padding that lets reverberations settle: fired in the given order (NULL
+/// for the order of the array), each line must start at least the settling
+/// time after the last firing of an overlapping transmit. Texo does not wait
+/// by itself, so the wait is added to the line fired before as a longer
+/// rx.customLineDuration. customLineDuration[i] receives the value to program
+/// for the i-th fired line (its own value when it needs no padding). Returns
+/// the padded frame duration in nanoseconds, or -1 on error. Settling across
+/// the end of the frame is not modelled
+double timingSettle(const _timingModel& model, const _timingLine* lines, int numLines, const int* order,
+                    int* customLineDuration);
+
+/// Order of the lines that needs the least settling padding. Lines with the
+/// same transmit are kept in their original order and other transmits are
+/// fired while one settles, e.g. channel-interleaved across scanlines
+bool timingOptimizeOrder(const _timingModel& model, const _timingLine* lines, int numLines, int* order);
+
+/// Fit model.lineOverhead so the predicted frame rate of the lines matches
+/// the frame rate measured on the scanner, and mark the model as calibrated
+void timingCalibrate(_timingModel& model, const _timingLine* lines, int numLines, double measuredFrameRate);
@@ -0,0 +1,125 @@
+/*
+ * @brief     Check of the sequence timing model and of the line order
+ *
+ * @details   Builds a singleTx-like sequence of 64 scanlines of 64 lines with
+ *            the same transmit per scanline, and checks with the default model:
+ *            the frame lasts the sum of the line durations (308 ms), the order
+ *            of the array needs settling padding up to 528 ms, the optimized
+ *            (interleaved) order needs none, and programming the padding as
+ *            rx.customLineDuration gives the padded duration. Then the model is
+ *            calibrated to a frame rate and must predict it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "timing.h"
+
+#define NUM_SCANLINES 64
+#define NUM_CHANNELS 64
+#define NUM_LINES (NUM_SCANLINES * NUM_CHANNELS)
+
+/// Expected durations in ms with the default model, and the tolerance
+#define EXPECTED_SUM 308.2
+#define EXPECTED_ARRAY_ORDER 528.5
+#define TOLERANCE 1.0
+
+/// Frame rate the model is calibrated to
+#define MEASURED_FRAME_RATE 20.0
+
+// Copy the lines in the given order with their padding programmed
+static void applyPadding(const _timingLine* lines, const int* order, const int* padding, _timingLine* padded)
+{
+    int i;
+
+    for (i = 0; i < NUM_LINES; i++)
+    {
+        padded[i] = lines[order ? order[i] : i];
+        padded[i].rx.customLineDuration = padding[i];
+    }
+}
+
+static bool near(double value, double expected)
+{
+    return fabs(value - expected) <= TOLERANCE;
+}
+
+int main()
+{
+    _timingModel model;
+    _timingLine* lines = (_timingLine*)calloc(NUM_LINES, sizeof(_timingLine));
+    _timingLine* padded = (_timingLine*)calloc(NUM_LINES, sizeof(_timingLine));
+    int* order = (int*)malloc(sizeof(int) * NUM_LINES);
+    int* padding = (int*)malloc(sizeof(int) * NUM_LINES);
+    double sum, arrayOrder, optimized, predicted;
+    bool ok, passed = true;
+    int s, c, i;
+
+    if (lines == NULL || padded == NULL || order == NULL || padding == NULL)
+    {
+        printf("ERROR: Not enough memory\n");
+        return -1;
+    }
+
+    // One transmit element per scanline, received on every channel
+    for (s = 0; s < NUM_SCANLINES; s++)
+    {
+        for (c = 0; c < NUM_CHANNELS; c++)
+        {
+            _timingLine& line = lines[s * NUM_CHANNELS + c];
+
+            line.tx.centerElement = s + 0.5;
+            line.tx.aperture = 0;
+            line.tx.frequency = 5000000;
+            strcpy(line.tx.pulseShape, "+-");
+            line.tx.txDelay = 100;
+            line.rx.acquisitionDepth = 50000;
+            line.rx.speedOfSound = 1540;
+            line.rx.decimation = 0;
+        }
+    }
+
+    timingDefaultModel(model);
+
+    sum = timingSequenceDuration(model, lines, NUM_LINES) / 1e6;
+    ok = !model.calibrated && near(sum, EXPECTED_SUM);
+    printf("Sum of the line durations: %.1f ms (expected %.1f ms)\n", sum, EXPECTED_SUM);
+    passed = passed && ok;
+
+    // Each scanline fires its transmit 64 times in a row
+    arrayOrder = timingSettle(model, lines, NUM_LINES, NULL, padding) / 1e6;
+    applyPadding(lines, NULL, padding, padded);
+    ok = near(arrayOrder, EXPECTED_ARRAY_ORDER) && near(timingSequenceDuration(model, padded, NUM_LINES) / 1e6, arrayOrder);
+    printf("Array order with settling padding: %.1f ms (expected %.1f ms)\n", arrayOrder, EXPECTED_ARRAY_ORDER);
+    passed = passed && ok;
+
+    // Other scanlines fire while one settles, so no padding is needed
+    ok = timingOptimizeOrder(model, lines, NUM_LINES, order);
+    optimized = ok ? timingSettle(model, lines, NUM_LINES, order, padding) / 1e6 : -1.0;
+
+    for (i = 0; ok && i < NUM_LINES; i++)
+    {
+        ok = (padding[i] == 0);
+    }
+
+    ok = ok && near(optimized, sum) && order[0] == 0 && order[1] == NUM_CHANNELS;
+    printf("Optimized order with settling padding: %.1f ms, %s\n", optimized, ok ? "no padding" : "PADDED");
+    passed = passed && ok;
+
+    timingCalibrate(model, lines, NUM_CHANNELS, MEASURED_FRAME_RATE);
+    predicted = 1e9 / timingSequenceDuration(model, lines, NUM_CHANNELS);
+    ok = model.calibrated && fabs(predicted - MEASURED_FRAME_RATE) < 0.01 * MEASURED_FRAME_RATE;
+    printf("Calibrated to %.1f fr/sec: predicts %.2f fr/sec\n", MEASURED_FRAME_RATE, predicted);
+    passed = passed && ok;
+
+    free(lines);
+    free(padded);
+    free(order);
+    free(padding);
+
+    printf("%s\n", passed ? "Timing check passed" : "Timing check FAILED");
+
+    return passed ? 0 : -1;
+}